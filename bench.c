@@ -0,0 +1,309 @@
+/* bench.c - benchmark scenarios tracked against a baseline
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "replifuck.h"
+#include "lineage.h"
+#include "bench.h"
+
+
+static const unsigned int rf_bench_populations[] = RFBENCH_POPULATIONS;
+
+
+/* Number of distinct genotypes of living threads (hash codes of their code
+ * at the end)
+ */
+static unsigned int rf_bench_census(rfvm_t *vm) {
+  GHashTable *genotypes;
+  rfth_t *thread;
+  unsigned int i, n;
+
+  genotypes = g_hash_table_new(NULL, NULL);
+  for (i=0; i<vm->threads->len; i++) {
+    thread = g_ptr_array_index(vm->threads, i);
+    if (!thread->dead) {
+      g_hash_table_insert(genotypes, GUINT_TO_POINTER(rf_lineage_genotype(vm, thread)), NULL);
+    }
+  }
+  n = g_hash_table_size(genotypes);
+  g_hash_table_destroy(genotypes);
+
+  return n;
+}
+
+
+/* Run scenario of result (in worker process). Short scenarios are repeated
+ * for RFBENCH_MIN_SECONDS, their time is the mean of the runs.
+ */
+static void rf_bench_worker(const rfconf_t *conf, struct rfbench_result *result, unsigned int cycles, rfimg_t *image) {
+  rfconf_t run_conf;
+  rfvm_t *vm;
+  gint64 start;
+  double total = 0.0;
+  unsigned int i, num_runs = 0;
+
+  memcpy(&run_conf, conf, sizeof(rfconf_t));
+  run_conf.seed = RFBENCH_SEED;
+  run_conf.rate_instr = RFBENCH_RATE_INSTR;
+  run_conf.rate_mem = RFBENCH_RATE_MEM;
+  run_conf.rate_kill = RFBENCH_RATE_KILL;
+  run_conf.initial_population = result->population;
+  run_conf.initial_spread = RFBENCH_SPREAD*result->population;
+  run_conf.max_threads = RFBENCH_MAX_THREADS*result->population;
+
+  do {
+    vm = rf_vm_new_full(&run_conf);
+    if (vm==NULL) {
+      return;
+    }
+    rf_seed_population(vm, &image, 1, run_conf.initial_population, 0, run_conf.initial_spread);
+
+    start = g_get_monotonic_time();
+    for (i=0; i<cycles; i++) {
+      rf_vm_cycle(vm);
+    }
+    total += (g_get_monotonic_time()-start)/1e6;
+    num_runs++;
+
+    /* runs are deterministic, so the census is the same every time */
+    result->seconds = total/num_runs;
+    result->cycles = vm->clock;
+    result->threads = rf_get_num_threads(vm);
+    result->births = vm->last_id;
+    result->genotypes = rf_bench_census(vm);
+    result->pages = g_tree_nnodes(vm->memory);
+    result->allocated = vm->virtual_pages.num_materialized;
+    result->instructions = vm->instructions;
+    result->failed = FALSE;
+
+    rf_vm_free(vm);
+  } while (total<RFBENCH_MIN_SECONDS);
+}
+
+
+/* Run scenarios of all programs (filenames are the programs' names), one at
+ * a time, each in a worker. Returns results of all scenarios (scenarios of
+ * failed workers are marked)
+ */
+GArray *rf_bench_run(const rfconf_t *conf, unsigned int cycles, rfimg_t **images, char **filenames, unsigned int num_images) {
+  GArray *results;
+  struct rfbench_result *run, result;
+  struct rusage usage;
+  unsigned int i, j;
+  gchar *program;
+  pid_t pid;
+  int fd[2], status;
+
+  results = g_array_new(FALSE, FALSE, sizeof(struct rfbench_result));
+  for (i=0; i<num_images; i++) {
+    program = g_path_get_basename(filenames[i]);
+    for (j=0; j<G_N_ELEMENTS(rf_bench_populations); j++) {
+      memset(&result, 0, sizeof(result));
+      g_strlcpy(result.program, program, sizeof(result.program));
+      result.population = rf_bench_populations[j];
+      result.failed = TRUE;
+      result.status = RFBENCH_UNCOMPARED;
+      g_array_append_val(results, result);
+    }
+    g_free(program);
+  }
+
+  /* workers mustn't write buffered output again */
+  fflush(NULL);
+
+  for (i=0; i<results->len; i++) {
+    run = &g_array_index(results, struct rfbench_result, i);
+    if (pipe(fd)<0) {
+      continue;
+    }
+
+    pid = fork();
+    if (pid==0) {
+      close(fd[0]);
+      rf_bench_worker(conf, run, cycles, images[i/G_N_ELEMENTS(rf_bench_populations)]);
+      if (write(fd[1], run, sizeof(*run))!=sizeof(*run)) {
+        _exit(1);
+      }
+      _exit(0);
+    }
+
+    close(fd[1]);
+    if (pid>0) {
+      /* the result fits into the pipe, so the worker is done when it's read */
+      if (read(fd[0], &result, sizeof(result))==sizeof(result)) {
+        *run = result;
+      }
+      while (wait4(pid, &status, 0, &usage)<0 && errno==EINTR);
+      run->max_rss = usage.ru_maxrss;
+      if (!WIFEXITED(status) || WEXITSTATUS(status)!=0) {
+        run->failed = TRUE;
+      }
+    }
+    close(fd[0]);
+  }
+
+  return results;
+}
+
+
+/* Load baseline from file. Returns NULL if it can't be read */
+GArray *rf_bench_load(const char *filename) {
+  GArray *baseline;
+  struct rfbench_result result;
+  FILE *fd;
+  char line[256];
+
+  fd = fopen(filename, "r");
+  if (fd==NULL) {
+    return NULL;
+  }
+
+  if (fgets(line, sizeof(line), fd)==NULL || strcmp(line, RFBENCH_MAGIC)!=0) {
+    fclose(fd);
+    return NULL;
+  }
+
+  baseline = g_array_new(FALSE, FALSE, sizeof(struct rfbench_result));
+  while (fgets(line, sizeof(line), fd)!=NULL) {
+    memset(&result, 0, sizeof(result));
+    if (sscanf(line, "%63s %u %u %u %u %u %u %u %" G_GUINT64_FORMAT " %lf %ld",
+               result.program, &result.population, &result.cycles, &result.threads,
+               &result.births, &result.genotypes, &result.pages, &result.allocated,
+               &result.instructions, &result.seconds, &result.max_rss)==11) {
+      g_array_append_val(baseline, result);
+    }
+  }
+
+  fclose(fd);
+
+  return baseline;
+}
+
+
+/* Store results (of workers that didn't fail) as baseline file */
+gboolean rf_bench_store(GArray *results, const char *filename) {
+  struct rfbench_result *run;
+  FILE *fd;
+  unsigned int i;
+
+  fd = fopen(filename, "w");
+  if (fd==NULL) {
+    return FALSE;
+  }
+
+  fputs(RFBENCH_MAGIC, fd);
+  for (i=0; i<results->len; i++) {
+    run = &g_array_index(results, struct rfbench_result, i);
+    if (!run->failed) {
+      fprintf(fd, "%s %u %u %u %u %u %u %u %" G_GUINT64_FORMAT " %.9g %ld\n",
+              run->program, run->population, run->cycles, run->threads, run->births,
+              run->genotypes, run->pages, run->allocated, run->instructions,
+              run->seconds, run->max_rss);
+    }
+  }
+
+  return fclose(fd)==0;
+}
+
+
+/* Compare results with baseline, setting their status. Returns number of
+ * scenarios that failed, changed or got slower by more than tolerance
+ */
+unsigned int rf_bench_compare(GArray *results, GArray *baseline, double tolerance) {
+  struct rfbench_result *run, *base;
+  unsigned int i, j, num_regressions = 0;
+
+  for (i=0; i<results->len; i++) {
+    run = &g_array_index(results, struct rfbench_result, i);
+    if (run->failed) {
+      run->status = RFBENCH_FAILED;
+      num_regressions++;
+      continue;
+    }
+
+    for (j=0; j<baseline->len; j++) {
+      base = &g_array_index(baseline, struct rfbench_result, j);
+      if (strcmp(base->program, run->program)==0 && base->population==run->population) {
+        break;
+      }
+    }
+    if (j==baseline->len) {
+      run->status = RFBENCH_UNCOMPARED;
+      continue;
+    }
+
+    run->baseline = base->seconds>0.0 ? base->instructions/base->seconds : 0.0;
+    if (base->cycles!=run->cycles || base->threads!=run->threads || base->births!=run->births
+        || base->genotypes!=run->genotypes || base->instructions!=run->instructions) {
+      run->status = RFBENCH_CHANGED;
+      num_regressions++;
+    }
+    else if (run->instructions<(1.0-tolerance)*run->baseline*run->seconds) {
+      run->status = RFBENCH_SLOWER;
+      num_regressions++;
+    }
+    else {
+      run->status = RFBENCH_OK;
+    }
+  }
+
+  return num_regressions;
+}
+
+
+/* Print table of scenarios */
+void rf_bench_print(GArray *results, FILE *fd) {
+  static const char *status_names[] = {"-", "ok", "slower", "changed", "failed"};
+  struct rfbench_result *run;
+  unsigned int i;
+  double throughput;
+
+  fprintf(fd, "# program population cycles threads births genotypes pages allocated max_rss instructions/s baseline change status\n");
+  for (i=0; i<results->len; i++) {
+    run = &g_array_index(results, struct rfbench_result, i);
+    if (run->failed) {
+      fprintf(fd, "%s %u failed\n", run->program, run->population);
+      continue;
+    }
+
+    throughput = run->seconds>0.0 ? run->instructions/run->seconds : 0.0;
+    fprintf(fd, "%s %u %u %u %u %u %u %u %ld %.0f ", run->program, run->population,
+            run->cycles, run->threads, run->births, run->genotypes, run->pages, run->allocated,
+            run->max_rss, throughput);
+    if (run->status!=RFBENCH_UNCOMPARED) {
+      fprintf(fd, "%.0f %+.1f%% %s\n", run->baseline,
+              run->baseline>0.0 ? 100.0*(throughput/run->baseline-1.0) : 0.0, status_names[run->status]);
+    }
+    else {
+      fprintf(fd, "- - -\n");
+    }
+  }
+}
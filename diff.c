@@ -0,0 +1,283 @@
+/* diff.c - differential testing of execution engines
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "replifuck.h"
+#include "diff.h"
+#include "tier.h"
+
+
+
+/* Iterator: collects pages of memory tree */
+static gboolean rf_diff_collect_page(void *key, void *value, void *userdata) {
+  g_ptr_array_add((GPtrArray*)userdata, key);
+  g_ptr_array_add((GPtrArray*)userdata, value);
+
+  return FALSE;
+}
+
+
+/* Hash page (FNV-1a), packed pages are read without unpacking them */
+static guint64 rf_diff_hash_page(rfvm_t *vm, int pid, const rfpage_t *page) {
+  guint64 hash = G_GUINT64_CONSTANT(0xcbf29ce484222325);
+  const rfword_t *data = page->data;
+  rfword_t *words = NULL;
+  unsigned int i;
+
+  if (page->packed!=NULL) {
+    words = g_new(rfword_t, vm->page_size);
+    rf_tier_read(vm, pid, page, words);
+    data = words;
+  }
+
+  for (i=0; i<vm->page_size; i++) {
+    hash ^= (guint8)data[i];
+    hash *= G_GUINT64_CONSTANT(0x100000001b3);
+  }
+
+  g_free(words);
+
+  return hash;
+}
+
+
+/* Compare memory. Returns TRUE if both VMs have the same pages */
+static gboolean rf_diff_compare_memory(rfvm_t *a, rfvm_t *b, struct rfdiff *result) {
+  GPtrArray *pages_a, *pages_b;
+  unsigned int i;
+  int pid_a, pid_b;
+  gboolean same = TRUE;
+
+  pages_a = g_ptr_array_new();
+  pages_b = g_ptr_array_new();
+  g_tree_foreach(a->memory, rf_diff_collect_page, pages_a);
+  g_tree_foreach(b->memory, rf_diff_collect_page, pages_b);
+
+  for (i=0; same && i<MIN(pages_a->len, pages_b->len); i+=2) {
+    pid_a = GPOINTER_TO_INT(g_ptr_array_index(pages_a, i));
+    pid_b = GPOINTER_TO_INT(g_ptr_array_index(pages_b, i));
+    if (pid_a!=pid_b) {
+      g_snprintf(result->reason, sizeof(result->reason), "page %d exists only in one VM", MIN(pid_a, pid_b));
+      same = FALSE;
+    }
+    else if (rf_diff_hash_page(a, pid_a, g_ptr_array_index(pages_a, i+1))!=rf_diff_hash_page(b, pid_b, g_ptr_array_index(pages_b, i+1))) {
+      g_snprintf(result->reason, sizeof(result->reason), "page %d differs", pid_a);
+      same = FALSE;
+    }
+  }
+  if (same && pages_a->len!=pages_b->len) {
+    g_snprintf(result->reason, sizeof(result->reason), "number of pages differs (%u, %u)", pages_a->len/2, pages_b->len/2);
+    same = FALSE;
+  }
+
+  g_ptr_array_free(pages_a, TRUE);
+  g_ptr_array_free(pages_b, TRUE);
+
+  return same;
+}
+
+
+/* Compare thread registers & parentheses stacks */
+static gboolean rf_diff_compare_thread(rfth_t *a, rfth_t *b) {
+  GSList *pa, *pb;
+
+  if (a->ip!=b->ip || a->dp!=b->dp || a->sp!=b->sp || a->clock!=b->clock
+      || a->dead!=b->dead || a->errors!=b->errors) {
+    return FALSE;
+  }
+
+  for (pa=a->pstack, pb=b->pstack; pa!=NULL && pb!=NULL; pa=pa->next, pb=pb->next) {
+    if (pa->data!=pb->data) {
+      return FALSE;
+    }
+  }
+
+  return pa==NULL && pb==NULL;
+}
+
+
+/* Compare state of two VMs. Returns TRUE if they are the same, otherwise the
+ * first difference is described in result
+ */
+gboolean rf_diff_compare(rfvm_t *a, rfvm_t *b, struct rfdiff *result) {
+  unsigned int i;
+  rfth_t *ta, *tb;
+
+  result->diverged = TRUE;
+  result->clock = a->clock;
+
+  if (a->clock!=b->clock || a->instructions!=b->instructions) {
+    g_snprintf(result->reason, sizeof(result->reason), "VM clocks differ");
+    return FALSE;
+  }
+
+  /* mutation counters & schedule */
+  if (a->mutations.num_instr!=b->mutations.num_instr || a->mutations.num_mem!=b->mutations.num_mem
+      || a->mutations.num_kill!=b->mutations.num_kill || a->mutations.next_instr!=b->mutations.next_instr
+      || a->mutations.next_mem!=b->mutations.next_mem || a->mutations.next_kill!=b->mutations.next_kill) {
+    g_snprintf(result->reason, sizeof(result->reason), "mutations differ (%u/%u/%u, %u/%u/%u)",
+               a->mutations.num_instr, a->mutations.num_mem, a->mutations.num_kill,
+               b->mutations.num_instr, b->mutations.num_mem, b->mutations.num_kill);
+    return FALSE;
+  }
+
+  /* threads & reaper queue */
+  if (a->threads->len!=b->threads->len || a->reaper.num_reaped!=b->reaper.num_reaped) {
+    g_snprintf(result->reason, sizeof(result->reason), "number of threads differs (%u, %u)", a->threads->len, b->threads->len);
+    return FALSE;
+  }
+  for (i=0; i<a->threads->len; i++) {
+    ta = g_ptr_array_index(a->threads, i);
+    tb = g_ptr_array_index(b->threads, i);
+    if (!rf_diff_compare_thread(ta, tb)) {
+      g_snprintf(result->reason, sizeof(result->reason), "thread %u differs (IP %ld, %ld)", i, ta->ip, tb->ip);
+      return FALSE;
+    }
+  }
+  for (ta=a->reaper.top, tb=b->reaper.top; ta!=NULL && tb!=NULL; ta=ta->reap_next, tb=tb->reap_next) {
+    if (ta->ip!=tb->ip || ta->clock!=tb->clock) {
+      break;
+    }
+  }
+  if (ta!=NULL || tb!=NULL) {
+    g_snprintf(result->reason, sizeof(result->reason), "reaper queues differ");
+    return FALSE;
+  }
+
+  if (!rf_diff_compare_memory(a, b, result)) {
+    return FALSE;
+  }
+
+  result->diverged = FALSE;
+  result->reason[0] = 0;
+
+  return TRUE;
+}
+
+
+/* Create VM with engine and seed it with images. Without images, threads are
+ * started at random positions of the random memory (random soup).
+ */
+static rfvm_t *rf_diff_new_vm(const rfconf_t *conf, int engine, rfimg_t **images, unsigned int num_images) {
+  rfconf_t vm_conf;
+  rfvm_t *vm;
+  unsigned int i;
+  rfp_t p;
+
+  memcpy(&vm_conf, conf, sizeof(rfconf_t));
+  vm_conf.engine = engine;
+
+  vm = rf_vm_new_full(&vm_conf);
+  if (vm==NULL) {
+    return NULL;
+  }
+
+  if (num_images>0) {
+    rf_seed_population(vm, images, num_images, conf->initial_population, 0, conf->initial_spread);
+  }
+  else {
+    for (i=0; i<conf->initial_population; i++) {
+      /* threads start on 0 words */
+      p = rf_rand_p(vm, 0, conf->initial_spread);
+      rf_memory_write(vm, p, 0, NULL);
+      rf_thread_add_full(vm, p, p, p, NULL, -1);
+    }
+  }
+
+  return vm;
+}
+
+
+/* Run two engines side by side for a number of cycles, comparing them every
+ * interval cycles. Returns TRUE if they don't diverge, otherwise result
+ * contains the first divergent clock.
+ */
+gboolean rf_diff_run(const rfconf_t *conf, int engine_a, int engine_b, rfimg_t **images, unsigned int num_images, unsigned int cycles, unsigned int interval, struct rfdiff *result) {
+  rfconf_t diff_conf;
+  rfvm_t *a, *b;
+  unsigned int clock, checked = 0;
+  gboolean same = TRUE;
+
+  /* both VMs need the same seed */
+  memcpy(&diff_conf, conf, sizeof(rfconf_t));
+  if (diff_conf.seed==0) {
+    diff_conf.seed = (unsigned long)g_random_int();
+  }
+  if (interval==0) {
+    interval = RFDIFF_INTERVAL;
+  }
+
+  a = rf_diff_new_vm(&diff_conf, engine_a, images, num_images);
+  b = rf_diff_new_vm(&diff_conf, engine_b, images, num_images);
+  if (a==NULL || b==NULL) {
+    g_snprintf(result->reason, sizeof(result->reason), "can't create VM");
+    result->diverged = TRUE;
+    result->clock = 0;
+    return FALSE;
+  }
+
+  same = rf_diff_compare(a, b, result);
+  for (clock=0; same && clock<cycles; clock++) {
+    rf_vm_cycle(a);
+    rf_vm_cycle(b);
+
+    if ((clock+1)%interval==0 || clock+1==cycles) {
+      same = rf_diff_compare(a, b, result);
+      if (same) {
+        checked = clock+1;
+      }
+    }
+  }
+
+  rf_vm_free(a);
+  rf_vm_free(b);
+
+  if (same) {
+    result->clock = cycles;
+    return TRUE;
+  }
+  else if (checked+1==result->clock || result->clock==0) {
+    return FALSE;
+  }
+
+  /* re-run from the start, comparing after every cycle since the last check
+   * (runs are deterministic, so they diverge again)
+   */
+  a = rf_diff_new_vm(&diff_conf, engine_a, images, num_images);
+  b = rf_diff_new_vm(&diff_conf, engine_b, images, num_images);
+  same = TRUE;
+  for (clock=0; same; clock++) {
+    rf_vm_cycle(a);
+    rf_vm_cycle(b);
+
+    if (clock+1>checked) {
+      same = rf_diff_compare(a, b, result);
+    }
+  }
+
+  rf_vm_free(a);
+  rf_vm_free(b);
+
+  return FALSE;
+}
@@ -0,0 +1,165 @@
+/* events.c - event hooks for programs embedding the VM
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "replifuck.h"
+#include "events.h"
+
+
+/* Registered hook */
+struct rfhook {
+  unsigned int id;
+  unsigned int types;
+  rfhook_func_t func;
+  void *userdata;
+};
+
+
+/* Register hook for events of types (bit mask of enum rfevent_type). Returns
+ * ID of the hook
+ */
+unsigned int rf_event_add_hook(rfvm_t *vm, unsigned int types, rfhook_func_t func, void *userdata) {
+  struct rfhook hook;
+
+  if (vm->events.hooks==NULL) {
+    vm->events.hooks = g_array_new(FALSE, FALSE, sizeof(struct rfhook));
+    vm->events.queue = g_array_new(FALSE, FALSE, sizeof(struct rfevent));
+    vm->events.batch = g_array_new(FALSE, FALSE, sizeof(struct rfevent));
+  }
+
+  hook.id = ++vm->events.last_id;
+  hook.types = types&RFEVENT_ALL;
+  hook.func = func;
+  hook.userdata = userdata;
+  g_array_append_val(vm->events.hooks, hook);
+
+  vm->events.types |= hook.types;
+
+  return hook.id;
+}
+
+
+/* Unregister hook
+ * NOTE: Don't call this from a hook
+ */
+void rf_event_remove_hook(rfvm_t *vm, unsigned int id) {
+  struct rfhook *hook;
+  unsigned int i;
+
+  if (vm->events.hooks==NULL) {
+    return;
+  }
+
+  vm->events.types = 0;
+  for (i=0; i<vm->events.hooks->len;) {
+    hook = &g_array_index(vm->events.hooks, struct rfhook, i);
+    if (hook->id==id) {
+      g_array_remove_index(vm->events.hooks, i);
+    }
+    else {
+      vm->events.types |= hook->types;
+      i++;
+    }
+  }
+
+  /* nobody wants events of other types anymore */
+  if (vm->events.types==0) {
+    g_array_set_size(vm->events.queue, 0);
+  }
+}
+
+
+/* Record event, call only if a hook wants events of this type */
+void rf_event_emit(rfvm_t *vm, int type, guint32 thread, guint32 parent, int cause, rfp_t p) {
+  struct rfevent event;
+
+  event.type = type;
+  event.clock = vm->clock;
+  event.thread = thread;
+  event.parent = parent;
+  event.cause = cause;
+  event.p = p;
+  g_array_append_val(vm->events.queue, event);
+
+  vm->events.queued |= type;
+}
+
+
+/* Pass recorded events to hooks. Events that hooks cause are passed with the
+ * next batch
+ */
+void rf_event_flush(rfvm_t *vm) {
+  GArray *batch, *filtered = NULL;
+  struct rfhook *hook;
+  struct rfevent *event;
+  unsigned int i, j, queued;
+
+  if (vm->events.queue==NULL || vm->events.queue->len==0) {
+    return;
+  }
+
+  batch = vm->events.queue;
+  vm->events.queue = vm->events.batch;
+  vm->events.batch = batch;
+  queued = vm->events.queued;
+  vm->events.queued = 0;
+
+  for (i=0; i<vm->events.hooks->len; i++) {
+    hook = &g_array_index(vm->events.hooks, struct rfhook, i);
+
+    if ((hook->types&queued)==queued) {
+      /* hook wants all of them */
+      hook->func(vm, (struct rfevent*)batch->data, batch->len, hook->userdata);
+    }
+    else if ((hook->types&queued)!=0) {
+      if (filtered==NULL) {
+        filtered = g_array_sized_new(FALSE, FALSE, sizeof(struct rfevent), batch->len);
+      }
+      g_array_set_size(filtered, 0);
+      for (j=0; j<batch->len; j++) {
+        event = &g_array_index(batch, struct rfevent, j);
+        if (hook->types&event->type) {
+          g_array_append_vals(filtered, event, 1);
+        }
+      }
+      hook->func(vm, (struct rfevent*)filtered->data, filtered->len, hook->userdata);
+    }
+  }
+
+  g_array_set_size(batch, 0);
+  if (filtered!=NULL) {
+    g_array_free(filtered, TRUE);
+  }
+}
+
+
+/* Free hooks & recorded events */
+void rf_event_free(rfvm_t *vm) {
+  if (vm->events.hooks!=NULL) {
+    g_array_free(vm->events.hooks, TRUE);
+    g_array_free(vm->events.queue, TRUE);
+    g_array_free(vm->events.batch, TRUE);
+  }
+  memset(&vm->events, 0, sizeof(vm->events));
+}
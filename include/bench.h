@@ -0,0 +1,135 @@
+/* include/bench.h - benchmark scenarios tracked against a baseline
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * A benchmark runs fixed scenarios: every program at each of the populations
+ * in RFBENCH_POPULATIONS, seeded with a fixed seed & spread and run with fixed
+ * mutation rates for a number of cycles (also if all threads died). The rest
+ * of the configuration (engine, scheduler, page size, ...) is taken as it is,
+ * so a baseline should only be compared with the configuration it was stored
+ * with.
+ *
+ * Scenarios run one after another, each in a worker process (so they don't
+ * compete for processors & caches, and the peak RSS of the worker is that of
+ * the scenario). A worker measures instructions per second (short
+ * scenarios are repeated), the number of pages allocated and takes a census at
+ * the end.
+ *
+ * Results can be stored as a baseline file and compared with one: a scenario
+ * regressed if its throughput dropped by more than a tolerance. Since
+ * scenarios are deterministic, the census must match the baseline too,
+ * otherwise the simulation changed and throughputs can't be compared.
+ */
+
+
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <glib.h>
+#include <stdio.h>
+
+#include "replifuck.h"
+
+
+/* Initial copies of each program in the scenarios */
+#define RFBENCH_POPULATIONS {4, 512, 10000}
+
+/* Default number of cycles per scenario */
+#define RFBENCH_CYCLES 1000
+
+/* Min. time a scenario is repeated for in seconds (short scenarios would only
+ * measure the clock's resolution, their time is the mean of the runs)
+ */
+#define RFBENCH_MIN_SECONDS 1.0
+
+/* Seed & mutation rates of all scenarios */
+#define RFBENCH_SEED       1
+#define RFBENCH_RATE_INSTR RFVM_RATE_INSTR
+#define RFBENCH_RATE_MEM   RFVM_RATE_MEM
+#define RFBENCH_RATE_KILL  RFVM_RATE_KILL
+
+/* Spread of initial copies & max. number of threads per initial copy */
+#define RFBENCH_SPREAD      256
+#define RFBENCH_MAX_THREADS 2
+
+/* Default max. relative drop of instructions per second */
+#define RFBENCH_TOLERANCE 0.1
+
+/* Magic string for baseline files */
+#define RFBENCH_MAGIC "# replifuck bench: program population cycles threads births genotypes pages allocated instructions seconds max_rss\n"
+
+/* Result of comparing a scenario with the baseline */
+enum rfbench_status {
+  RFBENCH_UNCOMPARED, /* no baseline or scenario isn't in it */
+  RFBENCH_OK,
+  RFBENCH_SLOWER,     /* throughput dropped by more than the tolerance */
+  RFBENCH_CHANGED,    /* census or number of cycles differ */
+  RFBENCH_FAILED      /* worker failed */
+};
+
+/* Result of a scenario */
+struct rfbench_result {
+  /* scenario: program (file name without directory) & initial copies */
+  char program[64];
+  unsigned int population;
+
+  /* worker failed (scenario is set anyway) */
+  gboolean failed;
+
+  /* cycles run */
+  unsigned int cycles;
+
+  /* census at the end: threads, threads created & distinct genotypes (see
+   * rf_lineage_genotype())
+   */
+  unsigned int threads;
+  guint32 births;
+  unsigned int genotypes;
+
+  /* pages in memory at the end & pages allocated (when they were written) */
+  unsigned int pages;
+  unsigned int allocated;
+
+  /* executed instructions & time of the cycles in seconds (mean of repeated
+   * runs)
+   */
+  guint64 instructions;
+  double seconds;
+
+  /* peak RSS of the worker in KiB */
+  long max_rss;
+
+  /* comparison with baseline (see enum rfbench_status) & throughput of the
+   * baseline
+   */
+  int status;
+  double baseline;
+};
+
+
+GArray *rf_bench_run(const rfconf_t *conf, unsigned int cycles, rfimg_t **images, char **filenames, unsigned int num_images);
+GArray *rf_bench_load(const char *filename);
+gboolean rf_bench_store(GArray *results, const char *filename);
+unsigned int rf_bench_compare(GArray *results, GArray *baseline, double tolerance);
+void rf_bench_print(GArray *results, FILE *fd);
+
+
+#endif /* _BENCH_H_ */
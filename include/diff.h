@@ -0,0 +1,59 @@
+/* include/diff.h - differential testing of execution engines
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Two VMs are created from the same configuration (and seed), differing only
+ * in their execution engine, and run side by side. Every few cycles their
+ * pages, threads and mutation counters are compared. When they diverge, both
+ * are re-run up to the last matching check and compared after every cycle,
+ * to find the first divergent clock.
+ */
+
+
+
+#ifndef _DIFF_H_
+#define _DIFF_H_
+
+#include <glib.h>
+
+#include "replifuck.h"
+
+
+/* Default number of cycles between comparisons */
+#define RFDIFF_INTERVAL 100
+
+/* Result of comparison */
+struct rfdiff {
+  /* VMs diverged */
+  gboolean diverged;
+
+  /* VM clock after the first divergent cycle (or number of run cycles) */
+  unsigned int clock;
+
+  /* Description of the first difference */
+  char reason[128];
+};
+
+
+gboolean rf_diff_compare(rfvm_t *a, rfvm_t *b, struct rfdiff *result);
+gboolean rf_diff_run(const rfconf_t *conf, int engine_a, int engine_b, rfimg_t **images, unsigned int num_images, unsigned int cycles, unsigned int interval, struct rfdiff *result);
+
+
+#endif /* _DIFF_H_ */
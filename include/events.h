@@ -0,0 +1,110 @@
+/* include/events.h - event hooks for programs embedding the VM
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Programs embedding the VM can register hooks for births & deaths of
+ * threads, mutations and pages put into memory. Events are only recorded,
+ * if a hook is registered for their type, so the VM doesn't slow down
+ * without hooks. They're collected during a cycle and passed to the hooks
+ * in a batch at the end of rf_vm_cycle(). Events that occur between cycles
+ * (e.g. threads added by rf_thread_add()) are passed with the next batch,
+ * or by rf_event_flush().
+ *
+ * Threads are referred to by ID (see rfth_t), since dead threads are freed
+ * before hooks are called.
+ */
+
+
+
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#include <glib.h>
+
+#include "replifuck.h"
+
+
+/* Event types (bit mask) */
+enum rfevent_type {
+  /* thread was created (parent is 0, if it wasn't forked), p is its IP */
+  RFEVENT_BIRTH = 1<<0,
+  /* thread was killed, cause is enum rfdeath */
+  RFEVENT_DEATH = 1<<1,
+  /* mutation occured, cause is enum rfmutation, p is the mutated position
+   * (memory mutations) or the thread's IP
+   */
+  RFEVENT_MUTATION = 1<<2,
+  /* page was put into memory (it was written first), p is its page ID */
+  RFEVENT_PAGE = 1<<3,
+  RFEVENT_ALL = (1<<4)-1
+};
+
+/* Causes of death */
+enum rfdeath {
+  /* killed by rf_thread_kill() or rf_thread_remove() */
+  RFDEATH_KILLED,
+  /* executed '*' */
+  RFDEATH_HALTED,
+  /* max. number of cycles reached */
+  RFDEATH_AGE,
+  /* kill mutation */
+  RFDEATH_MUTATION,
+  /* killed by the reaper to make room for a new thread */
+  RFDEATH_REAPED
+};
+
+/* Kinds of mutations */
+enum rfmutation {
+  RFMUTATION_INSTR,
+  RFMUTATION_MEM,
+  RFMUTATION_KILL
+};
+
+/* Event */
+struct rfevent {
+  /* type (see enum rfevent_type) */
+  int type;
+
+  /* VM clock */
+  unsigned int clock;
+
+  /* thread (0 for memory mutations & pages) and its parent (births) */
+  guint32 thread;
+  guint32 parent;
+
+  /* cause of death or kind of mutation */
+  int cause;
+
+  /* position or page ID (see enum rfevent_type) */
+  rfp_t p;
+};
+
+/* Hook, called with a batch of events of the types it was registered for */
+typedef void (*rfhook_func_t)(rfvm_t *vm, const struct rfevent *events, unsigned int n, void *userdata);
+
+
+unsigned int rf_event_add_hook(rfvm_t *vm, unsigned int types, rfhook_func_t func, void *userdata);
+void rf_event_remove_hook(rfvm_t *vm, unsigned int id);
+void rf_event_emit(rfvm_t *vm, int type, guint32 thread, guint32 parent, int cause, rfp_t p);
+void rf_event_flush(rfvm_t *vm);
+void rf_event_free(rfvm_t *vm);
+
+
+#endif /* _EVENTS_H_ */
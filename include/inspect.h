@@ -0,0 +1,107 @@
+/* include/inspect.h - inspection server for replifuck
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * External tools can inspect a running VM through a Unix domain socket. The
+ * protocol is line based: the client sends a command, the server answers
+ * with zero or more lines and an empty line. Commands are:
+ *
+ *   info      metrics of the VM ("key value" lines)
+ *   threads   thread table ("thread INDEX IP DP SP CLOCK ERRORS ID" lines)
+ *   pages     exported pages ("page PID SLOT" lines, SLOT -1 if the page
+ *             isn't exported)
+ *   writers PID
+ *             threads that last wrote the words of a page ("writers FIRST
+ *             LAST ID" lines for runs of words, see provenance.h)
+ *   map       "map SIZE PAGE_SIZE WORD_SIZE", the memory file descriptor is
+ *             passed along (SCM_RIGHTS)
+ *
+ * Page data isn't copied to clients: while the server runs, pages live in
+ * slots of a shared memory file, which clients map read-only. Page N of the
+ * VM is at offset SLOT*PAGE_SIZE*WORD_SIZE. Slots of freed pages are reused,
+ * so clients should fetch the page list again before reading. Pages of the
+ * memory window (see window.h) aren't exported.
+ */
+
+
+
+#ifndef _INSPECT_H_
+#define _INSPECT_H_
+
+#include <glib.h>
+
+#include "replifuck.h"
+
+
+/* Default max. number of exported pages */
+#define RFINSPECT_MAX_PAGES 0x10000
+
+/* Max. length of a command line */
+#define RFINSPECT_MAX_LINE 256
+
+
+/* Shared memory file holding page data */
+struct rfexport {
+  /* Number of VMs using this export (clones share it with their original) */
+  gint refs;
+
+  /* Memory file & its mapping */
+  int fd;
+  rfword_t *base;
+  gsize size;
+
+  /* Words per page & number of slots */
+  unsigned int page_size;
+  unsigned int max_pages;
+
+  /* Unused slots below the high watermark */
+  GArray *free_slots; /* with unsigned int */
+  unsigned int num_slots;
+
+  /* Number of used slots */
+  unsigned int num_used;
+};
+
+/* Inspection server */
+struct rfinspect {
+  rfvm_t *vm;
+
+  /* Listening socket & its path */
+  int fd;
+  char *path;
+
+  /* Connected clients */
+  GSList *clients; /* with struct rfinspect_client* */
+};
+
+
+struct rfexport *rf_export_new(unsigned int page_size, unsigned int max_pages, GError **error);
+void rf_export_unref(struct rfexport *export);
+void rf_export_attach(struct rfexport *export, rfvm_t *vm);
+rfword_t *rf_export_alloc(struct rfexport *export);
+void rf_export_release(struct rfexport *export, rfword_t *data);
+int rf_export_slot(struct rfexport *export, const rfword_t *data);
+
+struct rfinspect *rf_inspect_new(rfvm_t *vm, const char *path, unsigned int max_pages, GError **error);
+void rf_inspect_poll(struct rfinspect *inspect);
+void rf_inspect_free(struct rfinspect *inspect);
+
+
+#endif /* _INSPECT_H_ */
@@ -0,0 +1,86 @@
+/* include/lineage.h - lineage of threads
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Every thread gets a record with its ID, its parent's ID (the thread that
+ * forked it with 'Y', 0 for threads that weren't forked), birth & death clock
+ * and a hash of its code (the words after its IP up to the next 0). Records
+ * are appended, so they're sorted by ID and parents come before children.
+ *
+ * When the arena is full, records of dead threads without living descendants
+ * are pruned. If more than half of the arena is still used after that, the
+ * oldest records are dropped, too, so memory is bounded. Records may refer to
+ * parents that were dropped.
+ */
+
+
+
+#ifndef _LINEAGE_H_
+#define _LINEAGE_H_
+
+#include <glib.h>
+
+#include "replifuck.h"
+
+
+/* Max. number of words hashed as genotype */
+#define RFLINEAGE_MAX_GENOME 256
+
+/* Death clock of living threads */
+#define RFLINEAGE_ALIVE G_MAXUINT32
+
+/* Magic string for lineage files */
+#define RFLINEAGE_MAGIC "# replifuck lineage: id parent birth death genotype\n"
+
+
+/* Record of a thread */
+struct rflineage_record {
+  guint32 id;
+  guint32 parent;
+  guint32 birth;
+  guint32 death;
+  guint32 genotype;
+};
+
+/* Lineage of all threads of a VM */
+struct rflineage {
+  /* Records sorted by ID */
+  GArray *records; /* with struct rflineage_record */
+
+  /* Max. number of records */
+  unsigned int max_records;
+
+  /* Number of pruned (extinct) & dropped (oldest) records */
+  unsigned int num_pruned;
+  unsigned int num_dropped;
+};
+
+
+struct rflineage *rf_lineage_new(unsigned int max_records);
+struct rflineage *rf_lineage_copy(struct rflineage *lineage);
+void rf_lineage_free(struct rflineage *lineage);
+guint32 rf_lineage_genotype(rfvm_t *vm, rfth_t *thread);
+void rf_lineage_birth(rfvm_t *vm, rfth_t *thread, rfth_t *parent);
+void rf_lineage_death(rfvm_t *vm, rfth_t *thread);
+void rf_lineage_prune(struct rflineage *lineage);
+gboolean rf_lineage_export(struct rflineage *lineage, const char *filename);
+
+
+#endif /* _LINEAGE_H_ */
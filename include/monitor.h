@@ -0,0 +1,97 @@
+/* monitor.h - detection of extinction & steady states
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * A monitor watches a run for states in which it isn't interesting anymore:
+ *
+ *  - extinction: all threads are dead
+ *  - plateau: the number of threads stayed within a range (relative to the
+ *    max.) for a window of cycles
+ *  - fixation: at every census during a window of cycles, the same genotype
+ *    (hash code of a thread's code at birth, see rf_lineage_genotype()) was
+ *    shared by a min. fraction of the threads
+ *
+ * The population range is updated every cycle, a census of genotypes is
+ * taken RFMONITOR_CENSUSES times per window, so monitoring is cheap. Once a
+ * state is detected it's kept, the run can be stopped or stored by the
+ * caller.
+ */
+
+
+
+#ifndef _MONITOR_H_
+#define _MONITOR_H_
+
+#include <glib.h>
+
+#include "replifuck.h"
+
+
+/* Number of genotype censuses per window */
+#define RFMONITOR_CENSUSES 16
+
+/* States of a run */
+enum rfmonitor_state {
+  RFMONITOR_RUNNING,
+  RFMONITOR_EXTINCT,
+  RFMONITOR_PLATEAU,
+  RFMONITOR_FIXATION,
+  RFMONITOR_NUM_STATES
+};
+
+/* Monitor of a run */
+struct rfmonitor {
+  /* cycles a steady state must last, max. relative range of the population
+   * & min. fraction of threads with the dominant genotype
+   */
+  unsigned int window;
+  double tolerance;
+  double fixation;
+
+  /* detected state & clock it was detected at */
+  int state;
+  unsigned int clock;
+
+  /* range of the population since start clock */
+  struct {
+    unsigned int start;
+    unsigned int min;
+    unsigned int max;
+  } population;
+
+  /* dominant genotype since start clock (if fixating) */
+  struct {
+    gboolean fixating;
+    unsigned int start;
+    guint32 dominant;
+    unsigned int next_census;
+    GHashTable *census; /* genotype -> number of threads */
+  } genotypes;
+};
+
+
+const char *rf_monitor_state_name(int state);
+struct rfmonitor *rf_monitor_new(rfvm_t *vm);
+void rf_monitor_free(struct rfmonitor *monitor);
+gboolean rf_monitor_update(struct rfmonitor *monitor, rfvm_t *vm);
+
+
+#endif /* _MONITOR_H_ */
@@ -0,0 +1,75 @@
+/* include/native.h - native code for traces
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Traces that keep running are compiled to x86-64 machine code. Native code
+ * runs a number of iterations directly on the page of DP (and SP), which is
+ * computed beforehand, so that it neither leaves a page nor writes into its
+ * own loop. Other traces that may be written are dropped before. On other
+ * architectures traces are never compiled to native code.
+ */
+
+
+
+#ifndef _NATIVE_H_
+#define _NATIVE_H_
+
+#include <glib.h>
+
+#include "replifuck.h"
+#include "trace.h"
+
+
+/* Number of runs of a trace until it is compiled to native code */
+#define RFNATIVE_HOT 16
+
+/* Native loop: runs up to n iterations, returns number of run iterations */
+typedef unsigned int (*rfnative_func_t)(rfword_t *dp, rfword_t *sp, unsigned int n);
+
+/* Native code of a trace */
+struct rfnative {
+  /* Executable mapping */
+  void *code;
+  size_t size;
+  rfnative_func_t func;
+
+  /* DP offsets accessed in an iteration (including ']') */
+  int dp_min;
+  int dp_max;
+
+  /* Words written at DP in an iteration (adds & pops) */
+  unsigned int dp_writes;
+
+  /* SP offsets accessed & written in an iteration and SP movement */
+  gboolean uses_sp;
+  int sp_min;
+  int sp_max;
+  int sp_wmin;
+  int sp_wmax;
+  int sp_shift;
+};
+
+
+struct rfnative *rf_native_compile(struct rftrace *trace);
+void rf_native_free(struct rfnative *native);
+unsigned int rf_native_run(rfvm_t *vm, struct rftrace *trace, rfth_t *thread, unsigned int limit, gboolean *exited);
+
+
+#endif /* _NATIVE_H_ */
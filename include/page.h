@@ -0,0 +1,201 @@
+/* include/page.h - memory access for replifuck
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Inline memory access shared by the interpreter and the trace cache. All
+ * functions take the page shift as a parameter, so that they can be
+ * specialised for constant page sizes.
+ */
+
+
+
+#ifndef _PAGE_H_
+#define _PAGE_H_
+
+#include <glib.h>
+
+#include "replifuck.h"
+#include "trace.h"
+#include "provenance.h"
+#include "window.h"
+#include "tier.h"
+
+
+rfpage_t *rf_memory_lookup_page_slow(rfvm_t *vm, int pid, struct rfth_tlb *tlb);
+rfpage_t *rf_memory_unshare_page(rfvm_t *vm, int pid, rfpage_t *page);
+void rf_page_summary_update(rfvm_t *vm, rfpage_t *page, int first, int last, int sign);
+void rf_rand_page_words(unsigned long seed, int pid, rfword_t *data, unsigned int page_size);
+
+/* Words that are instructions are 1 */
+extern const guint8 rf_opcodes[256];
+
+
+/* Calculate page ID and offset from brainfuck pointer
+ * NOTE: page IDs are rounded towards negative infinity, so that consecutive
+ *       addresses are consecutive within a page, also for negative addresses.
+ */
+static inline void rf_memory_get_pid_and_offset(rfp_t p, const unsigned int page_shift, int *pid, unsigned int *off) {
+  if (p<0) {
+    *pid = -((-p-1)>>page_shift)-1;
+  }
+  else {
+    *pid = p>>page_shift;
+  }
+  *off = (unsigned long)p&((1UL<<page_shift)-1);
+}
+
+
+/* Get memory page */
+static inline rfpage_t *rf_memory_lookup_page(rfvm_t *vm, int pid, struct rfth_tlb *tlb) {
+  struct rfth_tlb_entry *entry;
+  rfpage_t *page;
+
+  /* pages of the window are indexed (and never cached) */
+  if (rf_window_has_page(vm, pid)) {
+    page = vm->window.pages[pid-vm->window.first];
+    return G_LIKELY(page!=NULL) ? page : rf_window_page(vm, pid);
+  }
+
+  /* fast path: most recently used way of the set */
+  if (tlb!=NULL && tlb->generation==vm->generation) {
+    entry = &tlb->sets[pid&(RFTH_TLB_SETS-1)][0];
+    if (entry->page!=NULL && entry->pid==pid) {
+      tlb->hits++;
+      return entry->page;
+    }
+  }
+
+  return rf_memory_lookup_page_slow(vm, pid, tlb);
+}
+
+
+/* Get memory page for writing (copies it, if it's shared with a clone, and
+ * puts virtual pages into memory)
+ */
+static inline rfpage_t *rf_memory_lookup_page_for_write(rfvm_t *vm, int pid, struct rfth_tlb *tlb) {
+  rfpage_t *page;
+
+  page = rf_memory_lookup_page(vm, pid, tlb);
+  if (G_UNLIKELY(g_atomic_int_get(&page->refs)!=1)) {
+    page = rf_memory_unshare_page(vm, pid, page);
+  }
+
+  return page;
+}
+
+
+/* Get memory page, if it's in memory (virtual pages aren't generated) */
+static inline rfpage_t *rf_memory_peek_page(rfvm_t *vm, int pid, struct rfth_tlb *tlb) {
+  struct rfth_tlb_entry *set;
+  rfpage_t *page;
+  unsigned int way;
+
+  if (tlb!=NULL && tlb->generation==vm->generation) {
+    set = tlb->sets[pid&(RFTH_TLB_SETS-1)];
+    for (way=0; way<RFTH_TLB_WAYS; way++) {
+      if (set[way].page!=NULL && set[way].pid==pid) {
+        return g_atomic_int_get(&set[way].page->refs)>0 ? set[way].page : NULL;
+      }
+    }
+  }
+
+  page = g_tree_lookup(vm->memory, GINT_TO_POINTER(pid));
+  if (page!=NULL && G_UNLIKELY(page->packed!=NULL)) {
+    page = rf_tier_unpack(vm, pid, page);
+  }
+
+  return page;
+}
+
+
+/* Read/write word at position p with page size known at compile time */
+static inline rfword_t rf_memory_read_fast(rfvm_t *vm, rfp_t p, struct rfth_tlb *tlb, const unsigned int page_shift) {
+  int pid;
+  unsigned int off;
+
+  /* words of the window are read in place (see window.h) */
+  if (rf_window_has(vm, p)) {
+    return vm->window.data[p-vm->window.start];
+  }
+
+  rf_memory_get_pid_and_offset(p, page_shift, &pid, &off);
+  return rf_memory_lookup_page(vm, pid, tlb)->data[off];
+}
+
+/* Write word at position p, which is at offset off of page (looked up for
+ * writing)
+ */
+static inline void rf_memory_write_page(rfvm_t *vm, rfpage_t *page, rfp_t p, unsigned int off, rfword_t data) {
+  /* keep summary up to date (signature matches are slow, but rarely counted) */
+  if (G_UNLIKELY(vm->signature.length>0)) {
+    rf_page_summary_update(vm, page, off, off, -1);
+    page->data[off] = data;
+    rf_page_summary_update(vm, page, off, off, 1);
+  }
+  else {
+    page->summary.num_opcodes += rf_opcodes[(guint8)data]-rf_opcodes[(guint8)page->data[off]];
+    page->data[off] = data;
+  }
+  page->summary.num_writes++;
+  page->dirty = TRUE;
+
+  if (G_UNLIKELY(vm->conf.provenance)) {
+    rf_provenance_write(vm, page, off, vm->writer);
+  }
+
+  /* self-modification: drop traces compiled from this word */
+  if (G_UNLIKELY(page->traces!=NULL)) {
+    rf_trace_invalidate(vm, page, p, p);
+  }
+}
+
+static inline void rf_memory_write_fast(rfvm_t *vm, rfp_t p, rfword_t data, struct rfth_tlb *tlb, const unsigned int page_shift) {
+  int pid;
+  unsigned int off;
+
+  rf_memory_get_pid_and_offset(p, page_shift, &pid, &off);
+  rf_memory_write_page(vm, rf_memory_lookup_page_for_write(vm, pid, tlb), p, off, data);
+}
+
+
+/* Copy word from position from to position to (pushes & pops). If both are on
+ * the same page, it's looked up only once. Returns TRUE in that case.
+ */
+static inline gboolean rf_memory_move_fast(rfvm_t *vm, rfp_t from, rfp_t to, struct rfth_tlb *tlb, const unsigned int page_shift) {
+  int pid, from_pid;
+  unsigned int off, from_off;
+  rfpage_t *page;
+  rfword_t data;
+
+  rf_memory_get_pid_and_offset(from, page_shift, &from_pid, &from_off);
+  rf_memory_get_pid_and_offset(to, page_shift, &pid, &off);
+  if (pid!=from_pid) {
+    data = rf_memory_read_fast(vm, from, tlb, page_shift);
+    rf_memory_write_page(vm, rf_memory_lookup_page_for_write(vm, pid, tlb), to, off, data);
+    return FALSE;
+  }
+
+  page = rf_memory_lookup_page_for_write(vm, pid, tlb);
+  rf_memory_write_page(vm, page, to, off, page->data[from_off]);
+  return TRUE;
+}
+
+
+#endif /* _PAGE_H_ */
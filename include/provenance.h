@@ -0,0 +1,83 @@
+/* include/provenance.h - writers of memory words
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * With provenance recorded, each page has a shadow with the ID of the thread
+ * that last wrote each word (see rfth_t). Words that were never written by a
+ * thread (random initial content, loaded code, mutations) have writer 0.
+ *
+ * Shadows are compressed: as long as all words of a page have the same
+ * writer, only that writer is stored. The list of writers is allocated on
+ * the first write by another thread and freed again when a single writer
+ * has overwritten all words. Shadows are shared with clones like pages.
+ *
+ * NOTE: Native code doesn't record writers, so traces aren't compiled to
+ *       native code while provenance is recorded.
+ */
+
+
+
+#ifndef _PROVENANCE_H_
+#define _PROVENANCE_H_
+
+#include <glib.h>
+
+#include "replifuck.h"
+
+
+/* Writer of words not written by a thread */
+#define RFPROV_NONE 0
+
+
+void rf_provenance_expand(rfvm_t *vm, rfpage_t *page);
+void rf_provenance_compress(rfvm_t *vm, rfpage_t *page, unsigned int off);
+void rf_provenance_write_range(rfvm_t *vm, rfpage_t *page, unsigned int first, unsigned int last, guint32 writer);
+void rf_provenance_copy(rfvm_t *vm, rfpage_t *copy, rfpage_t *page);
+void rf_provenance_free(rfpage_t *page);
+gboolean rf_provenance_get(rfvm_t *vm, int pid, guint32 *writers);
+
+
+/* Record writer of word at offset off of a page */
+static inline void rf_provenance_write(rfvm_t *vm, rfpage_t *page, unsigned int off, guint32 writer) {
+  struct rfpage_shadow *shadow = &page->shadow;
+  guint32 old;
+
+  if (shadow->writers==NULL) {
+    if (writer==shadow->writer) {
+      return;
+    }
+    rf_provenance_expand(vm, page);
+  }
+
+  old = shadow->writers[off];
+  if (old==writer) {
+    return;
+  }
+  shadow->writers[off] = writer;
+  shadow->num_foreign += (writer!=shadow->writer)-(old!=shadow->writer);
+
+  /* page may have a single writer again */
+  if (shadow->num_foreign==0 || shadow->num_foreign==vm->page_size) {
+    rf_provenance_compress(vm, page, off);
+  }
+}
+
+
+#endif /* _PROVENANCE_H_ */
@@ -0,0 +1,41 @@
+/* include/reaper.h - population control for replifuck
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#ifndef _REAPER_H_
+#define _REAPER_H_
+
+#include <glib.h>
+
+#include "replifuck.h"
+
+
+int rf_reaper_policy_parse(const char *name);
+const char *rf_reaper_policy_name(int policy);
+void rf_reaper_push(rfvm_t *vm, rfth_t *thread);
+void rf_reaper_unlink(rfvm_t *vm, rfth_t *thread);
+void rf_reaper_error(rfvm_t *vm, rfth_t *thread);
+void rf_reaper_reward(rfvm_t *vm, rfth_t *thread);
+rfth_t *rf_reaper_select(rfvm_t *vm);
+
+#endif /* _REAPER_H_ */
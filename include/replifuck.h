@@ -27,7 +27,8 @@
  *
  * Futher notes:
  *  - Since memory is endless, the command '*' is used as termination command.
- *  - Memory is initialized with random values, not 0
+ *  - Memory is initialized with random values, not 0. They only depend on the
+ *    seed and the address, not on when a page is touched first.
  *
  * TODO: manage threads in a list and supply previous/next
  * TODO: a Gtk GUI with more advanced widgest would be neat (e.g. population graph, signature scanning, 2D memory view)
@@ -43,21 +44,92 @@
 
 /* Macro definitions */
 
-/* size of allocated memory page */
+/* Default size of allocated memory page (must be a power of 2) */
 #define RFMEM_PAGE_SIZE 0x1000
 
+/* Max. size of memory pages */
+#define RFMEM_MAX_PAGE_SIZE 0x1000000
+
+/* Number of virtual pages, never written pages that are only read (must be
+ * a power of 2)
+ */
+#define RFMEM_VIRTUAL_PAGES 16
+
 /* Magic string for dump files */
 #define RFMEM_DUMP_MAGIC "!reprfuck memdump\n"
 #define RFMEM_DUMP_MAGIC_LENGTH 18
 
-/* Max. number of threads 
- * NOTE: Undefine for unlimited number
+/* Size of the buffer VM states are written with */
+#define RFMEM_DUMP_BUFFER 0x100000
+
+/* Magic string for program images */
+#define RFIMG_MAGIC "!reprfuck image\n"
+#define RFIMG_MAGIC_LENGTH 16
+
+/* Default max. number of threads
+ * NOTE: 0 for unlimited number
  */
 #define RFVM_MAX_THREADS 512
 
-/* Max. number of cycles per thread */
+/* Default max. number of cycles per thread (0 for unlimited) */
 #define RFTH_MAX_CYCLES   50000
 
+/* Default reaper policy (see enum rfreap_policy) */
+#define RFVM_REAPER RFREAP_NONE
+
+/* Default scheduler policy (see enum rfsched_policy), quantum and budget */
+#define RFVM_SCHEDULER RFSCHED_ROUND_ROBIN
+#define RFVM_QUANTUM   1
+#define RFVM_BUDGET    1024
+
+/* Default execution engine (see enum rfengine) */
+#define RFVM_ENGINE RFENGINE_INTERP
+
+/* Max. number of lottery tickets per thread (code size is measured up to this) */
+#define RFTH_MAX_TICKETS 1024
+
+/* Default mutation rates */
+#define RFVM_RATE_INSTR 0.000001
+#define RFVM_RATE_MEM   0.00001
+#define RFVM_RATE_KILL  0.000001
+
+/* Default initial population: number of copies and their spread around 0 */
+#define RFVM_INITIAL_POPULATION 4
+#define RFVM_INITIAL_SPREAD     0x2000
+
+/* Default max. number of lineage records (0 to not record lineage) */
+#define RFVM_LINEAGE 0
+
+/* Record writers of words by default */
+#define RFVM_PROVENANCE FALSE
+
+/* Default number of cycles between evictions of clean pages (0 for never) */
+#define RFVM_EVICT_INTERVAL 0
+
+/* Default number of pages in the memory window (0 for no window) */
+#define RFVM_WINDOW 0
+
+/* Default number of cycles between sorting pages into tiers (0 for never)
+ * & max. number of hot pages (see tier.h)
+ */
+#define RFVM_TIER_INTERVAL 0
+#define RFVM_TIER_HOT 256
+
+/* Default number of cycles a steady state must last to be detected (0 to not
+ * monitor runs), max. relative range of the population in a plateau & min.
+ * fraction of threads with the same genotype for fixation (see monitor.h)
+ */
+#define RFVM_MONITOR_WINDOW 0
+#define RFVM_MONITOR_TOLERANCE 0.05
+#define RFVM_MONITOR_FIXATION 0.95
+
+/* Key file group of experiment configuration */
+#define RFCONF_GROUP "experiment"
+
+/* Geometry of the per-thread TLB (sets must be a power of 2) */
+#define RFTH_TLB_SETS 4
+#define RFTH_TLB_WAYS 2
+
 
 /* Data types */
 
@@ -76,11 +148,128 @@ typedef struct rfvm rfvm_t;
 /* Type of brainfuck thread */
 typedef struct rfth rfth_t;
 
+/* Type of experiment configuration */
+typedef struct rfconf rfconf_t;
+
+/* Type of program image */
+typedef struct rfimg rfimg_t;
+
+/* Type of memory page */
+typedef struct rfpage rfpage_t;
+
+
+/* Reaper policies: which thread is killed, if a fork exceeds the thread cap */
+enum rfreap_policy {
+  /* don't reap, refuse new thread */
+  RFREAP_NONE,
+  /* oldest thread */
+  RFREAP_OLDEST,
+  /* random thread */
+  RFREAP_RANDOM,
+  /* top of reaper queue, threads move up when making errors (like Tierra) */
+  RFREAP_ERRORS,
+  RFREAP_NUM_POLICIES
+};
+
+/* Scheduler policies: how instructions are distributed in a VM cycle */
+enum rfsched_policy {
+  /* every thread runs a quantum */
+  RFSCHED_ROUND_ROBIN,
+  /* quanta are drawn until budget is spent, threads have code size as tickets */
+  RFSCHED_LOTTERY,
+  /* budget is spent in quanta, round robin, continuing in next cycle */
+  RFSCHED_BUDGET,
+  RFSCHED_NUM_POLICIES
+};
+
+/* Execution engines */
+enum rfengine {
+  /* reference interpreter */
+  RFENGINE_INTERP,
+  /* interpreter, hot loops are run from the trace cache */
+  RFENGINE_TRACE,
+  /* like trace, stable traces are compiled to native code (x86-64 only) */
+  RFENGINE_NATIVE,
+  RFENGINE_NUM_ENGINES
+};
+
 
 /* Data structures */
 
+/* Experiment configuration */
+struct rfconf {
+  /* Seed for random number generator (0 for random seed) */
+  unsigned long seed;
+
+  /* Size of memory pages (must be a power of 2) */
+  unsigned int page_size;
+
+  /* Max. number of threads (0 for unlimited) */
+  unsigned int max_threads;
+
+  /* Reaper policy (see enum rfreap_policy) */
+  int reaper;
+
+  /* Max. number of cycles per thread (0 for unlimited) */
+  unsigned int max_cycles;
+
+  /* Scheduler policy (see enum rfsched_policy), instructions per quantum and
+   * instructions per VM cycle (not used by round robin)
+   */
+  int scheduler;
+  unsigned int quantum;
+  unsigned int budget;
+
+  /* Execution engine (see enum rfengine) */
+  int engine;
+
+  /* Initial population: number of copies and their spread around 0 */
+  unsigned int initial_population;
+  rfsz_t initial_spread;
+
+  /* Mutation rates */
+  double rate_instr;
+  double rate_mem;
+  double rate_kill;
+
+  /* Max. number of lineage records (0 to not record lineage, see lineage.h) */
+  unsigned int lineage;
+
+  /* Record which thread last wrote each word (see provenance.h) */
+  gboolean provenance;
+
+  /* Number of cycles between evictions of clean pages (0 for never) */
+  unsigned int evict_interval;
+
+  /* Number of pages around 0 kept in a memory window (0 for no window, see
+   * window.h)
+   */
+  unsigned int window;
+
+  /* Number of cycles between sorting pages into tiers (0 for never) & max.
+   * number of hot pages (see tier.h)
+   */
+  unsigned int tier_interval;
+  unsigned int tier_hot;
+
+  /* Detection of steady states: cycles they must last (0 to not monitor
+   * runs), max. relative range of the population & min. fraction of the
+   * dominant genotype (see monitor.h)
+   */
+  unsigned int monitor_window;
+  double monitor_tolerance;
+  double monitor_fixation;
+};
+
 /* Virtual machine */
 struct rfvm {
+  /* Configuration the VM was created with */
+  rfconf_t conf;
+
+  /* Page size and its binary logarithm */
+  unsigned int page_size;
+  unsigned int page_shift;
+
   /* Random number generator */
   gsl_rng *rand;
 
@@ -90,9 +279,166 @@ struct rfvm {
   /* All execution threads */
   GPtrArray *threads; /* with rfth_t* */
 
+  /* Reaper queue */
+  struct {
+    /* next victim & newest thread */
+    rfth_t *top;
+    rfth_t *bottom;
+
+    /* number of threads killed in this cycle, but not yet removed */
+    unsigned int num_dead;
+
+    /* number of reaped threads */
+    unsigned int num_reaped;
+  } reaper;
+
   /* Clock (how many cycles this VM has done) */
   unsigned int clock;
 
+  /* ID of the newest thread (IDs start at 1) */
+  guint32 last_id;
+
+  /* ID of the running thread (0 between cycles), recorded as writer */
+  guint32 writer;
+
+  /* Number of executed instructions */
+  guint64 instructions;
+
+  /* Scheduler state: next thread of budget scheduler */
+  struct {
+    unsigned int cursor;
+  } sched;
+
+  /* Memory generation: incremented whenever pages are freed or moved, so that
+   * thread TLBs know that their entries are stale
+   */
+  unsigned int generation;
+
+  /* Number of pages copied, because they were shared with a clone */
+  unsigned int num_unshared;
+
+  /* Number of clean pages freed (they're created again when accessed) */
+  unsigned int num_evicted;
+
+  /* Virtual pages: pages that weren't written are generated for reading, but
+   * not put into memory. They're put into memory when they're written.
+   */
+  struct {
+    /* pages & their IDs by page ID modulo RFMEM_VIRTUAL_PAGES (or NULL) */
+    rfpage_t *pages[RFMEM_VIRTUAL_PAGES];
+    int pids[RFMEM_VIRTUAL_PAGES];
+
+    /* number of generated & written pages */
+    unsigned int num_generated;
+    unsigned int num_materialized;
+  } virtual_pages;
+
+  /* Memory window (see window.h): words of the pages around 0 at fixed
+   * positions of a reserved address range
+   */
+  struct {
+    /* words, position of the first word & number of words (NULL & 0 if
+     * there is no window)
+     */
+    rfword_t *data;
+    rfp_t start;
+    rfsz_t length;
+
+    /* pages by page ID minus ID of first page (NULL if not looked up) */
+    rfpage_t **pages;
+    int first;
+    unsigned int num_pages;
+
+    /* number of words committed at once on first access */
+    rfsz_t commit;
+  } window;
+
+  /* Tiers of pages (see tier.h) */
+  struct {
+    /* arena of hot pages (NULL if pages aren't sorted into tiers) */
+    struct rfarena *arena;
+
+    /* number of packed (cold) pages & their size in bytes */
+    unsigned int num_packed;
+    rfsz_t packed_size;
+
+    /* number of promoted (to hot), demoted & unpacked pages */
+    unsigned int num_promoted;
+    unsigned int num_demoted;
+    unsigned int num_unpacked;
+  } tier;
+
+  /* Shared memory file new pages are put in (see inspect.h), or NULL */
+  struct rfexport *export;
+
+  /* Lineage of threads or NULL (see lineage.h) */
+  struct rflineage *lineage;
+
+  /* Event hooks (see events.h) */
+  struct {
+    /* types of events hooks are registered for (bit mask) */
+    unsigned int types;
+
+    /* types of recorded events */
+    unsigned int queued;
+
+    /* hooks, recorded events & events being passed to hooks (NULL if no
+     * hook was ever registered)
+     */
+    GArray *hooks;
+    GArray *queue;
+    GArray *batch;
+
+    /* ID of the newest hook */
+    unsigned int last_id;
+  } events;
+
+  /* Signature counted in page summaries (length 0 if none) */
+  struct {
+    rfword_t *data;
+    unsigned int length;
+  } signature;
+
+  /* Trace cache (see trace.h) */
+  struct {
+    /* loops by position of '[' */
+    GHashTable *cache;
+
+    /* number of compiled & invalidated (or flushed) traces */
+    unsigned int num_compiled;
+    unsigned int num_invalidated;
+
+    /* number of traces compiled to native code */
+    unsigned int num_native;
+
+    /* number of instructions run from traces & natively */
+    guint64 instructions;
+    guint64 native_instructions;
+  } trace;
+
+  /* Stack statistics (see stack.h) */
+  struct {
+    /* number of pushes & pops */
+    guint64 pushes;
+    guint64 pops;
+
+    /* number of runs of pushes or pops & instructions run in them */
+    unsigned int num_runs;
+    guint64 run_instructions;
+
+    /* number of pushes & pops with SP and DP on the same page (interpreter) */
+    guint64 shared;
+
+    /* number of stack bases set, deepest stack & number of underflows */
+    unsigned int num_bases;
+    rfsz_t max_depth;
+    guint64 underflows;
+  } stack;
+
+  /* TLB statistics of removed threads */
+  unsigned long tlb_hits;
+  unsigned long tlb_misses;
+
   /* Error rate & number of occured mutations */
   struct {
     double rate_instr;
@@ -101,14 +447,104 @@ struct rfvm {
     unsigned int num_instr;
     unsigned int num_mem;
     unsigned int num_kill;
+
+    /* instructions until next mutation (a countdown reaching 0 triggers it) */
+    guint64 next_instr;
+    guint64 next_mem;
+    guint64 next_kill;
   } mutations;
 };
 
-/* Execution thread */
-struct rfth_page_cache {
+/* Summary of a memory page, kept up to date on writes (see page.h) */
+struct rfpage_summary {
+  /* number of words that are instructions */
+  unsigned int num_opcodes;
+
+  /* number of signature matches starting in this page */
+  unsigned int num_signatures;
+
+  /* number of writes since this was last reset */
+  unsigned int num_writes;
+};
+
+/* Writers of the words of a page (see provenance.h) */
+struct rfpage_shadow {
+  /* writer of all words, or of most words if they're listed */
+  guint32 writer;
+
+  /* number of words not written by that writer */
+  unsigned int num_foreign;
+
+  /* writer of each word (NULL if all have the same writer) */
+  guint32 *writers;
+};
+
+/* Memory page */
+struct rfpage {
+  /* Words (page size) */
+  rfword_t *data;
+
+  /* Number of VMs sharing this page (it's copied before it's written), 0
+   * for virtual pages (they're put into memory before they're written)
+   */
+  gint refs;
+
+  /* Words were written since the page was created (otherwise they can be
+   * created again from the seed)
+   */
+  gboolean dirty;
+
+  /* Shared memory file the words are in (NULL if they follow the page) */
+  struct rfexport *export;
+
+  /* Words are in the VM's memory window, which keeps the page when it isn't
+   * in memory (see window.h)
+   */
+  gboolean window;
+
+  /* Tiering (see tier.h): heat, number of passes the page stayed cold & its
+   * number of writes at the last pass
+   */
+  unsigned int heat;
+  unsigned int cold;
+  unsigned int tier_writes;
+
+  /* Arena & slot the words are in, if the page is hot (otherwise NULL) */
+  struct rfarena *arena;
+  unsigned int slot;
+
+  /* Packed words, if the page is cold (data is NULL then) */
+  guint8 *packed;
+  unsigned int packed_size;
+
+  /* Compiled traces covering words of this page (never shared) */
+  GSList *traces;
+
+  /* Summary (for overviews) */
+  struct rfpage_summary summary;
+
+  /* Writers of the words (all 0 if provenance isn't recorded) */
+  struct rfpage_shadow shadow;
+};
+
+/* Page lookup cache (set associative, shared by IP, DP and SP) */
+struct rfth_tlb_entry {
   int pid;
-  rfword_t *page;
+  rfpage_t *page;
 };
+struct rfth_tlb {
+  /* memory generation the entries are valid for */
+  unsigned int generation;
+
+  /* entries, most recently used way first */
+  struct rfth_tlb_entry sets[RFTH_TLB_SETS][RFTH_TLB_WAYS];
+
+  /* statistics */
+  unsigned long hits;
+  unsigned long misses;
+};
+
+/* Execution thread */
 struct rfth {
   /* Instruction pointer */
   rfp_t ip;
@@ -119,42 +555,108 @@ struct rfth {
   /* Stack pointer */
   rfp_t sp;
 
+  /* Stack base (see stack.h) */
+  rfp_t sb;
+
   /* Clock (how many cycles this thread has done) */
   unsigned int clock;
 
+  /* ID (unique in the VM, also used in lineage & provenance) */
+  guint32 id;
+
+  /* Lottery tickets (code size) */
+  unsigned int tickets;
+
   /* Stack used for parentheses matching */
   GSList *pstack;
 
+  /* Last instruction jumped back to a '[' (entry point of trace cache) */
+  gboolean backedge;
+
+  /* Last instruction was a push or pop (a run of them may follow, see
+   * stack.h)
+   */
+  gboolean stackop;
+
+  /* Thread was killed and will be removed at the end of the cycle */
+  gboolean dead;
+
+  /* Cause of death, set before the thread is killed (see enum rfdeath in
+   * events.h)
+   */
+  int death;
+
+  /* Hash code of its code at birth (0 unless lineage is recorded or runs are
+   * monitored, see rf_lineage_genotype())
+   */
+  guint32 genotype;
+
+  /* Number of errors (unmatched parentheses, failed forks) */
+  unsigned int errors;
+
+  /* Neighbours in reaper queue */
+  rfth_t *reap_prev;
+  rfth_t *reap_next;
+
   /* Page lookup cache */
-  struct rfth_page_cache page_cache_ip;
-  struct rfth_page_cache page_cache_dp;
-  struct rfth_page_cache page_cache_sp;
+  struct rfth_tlb tlb;
 };
 
 
+/* Program image (compiled brainfuck source) */
+struct rfimg {
+  /* Code */
+  rfword_t *code;
+
+  /* Number of words */
+  rfsz_t length;
+};
+
 
 /* Function prototypes */
 
 rfp_t rf_rand_p(rfvm_t *vm, rfp_t mu, rfsz_t sigma);
+int rf_sched_policy_parse(const char *name);
+const char *rf_sched_policy_name(int policy);
+int rf_engine_parse(const char *name);
+const char *rf_engine_name(int engine);
+void rf_conf_init(rfconf_t *conf);
+gboolean rf_conf_load(rfconf_t *conf, const char *filename, GError **error);
+rfvm_t *rf_vm_new_full(const rfconf_t *conf);
 rfvm_t *rf_vm_new(void);
 rfvm_t *rf_vm_new_with_seed(unsigned long seed);
 void rf_vm_free(rfvm_t *vm);
+rfvm_t *rf_vm_clone(rfvm_t *vm);
+void rf_vm_set_mutation_rates(rfvm_t *vm, double rate_instr, double rate_mem, double rate_kill);
+void rf_vm_set_signature(rfvm_t *vm, const rfword_t *signature, unsigned int length);
 void rf_vm_set_debug(rfvm_t *vm, gboolean on_off);
 rfth_t *rf_thread_add_full(rfvm_t *vm, rfp_t ip, rfp_t dp, rfp_t sp, const rfword_t *code, int code_length);
 rfth_t *rf_thread_add(rfvm_t *vm);
 void rf_thread_remove(rfvm_t *vm, rfth_t *thread);
+void rf_thread_kill(rfvm_t *vm, rfth_t *thread);
 gboolean rf_thread_cycle(rfvm_t *vm, rfth_t *thread);
 void rf_vm_cycle(rfvm_t *vm);
 void rf_memory_mutate(rfvm_t *vm);
-rfword_t rf_memory_read(rfvm_t *vm, rfp_t p, struct rfth_page_cache *page_cache);
-void rf_memory_write(rfvm_t *vm, rfp_t p, rfword_t data, struct rfth_page_cache *page_cache);
-rfsz_t rf_memory_load_data(rfvm_t *vm, rfp_t p, const rfword_t *data, rfsz_t n);
+rfword_t rf_memory_read(rfvm_t *vm, rfp_t p, struct rfth_tlb *tlb);
+void rf_memory_write(rfvm_t *vm, rfp_t p, rfword_t data, struct rfth_tlb *tlb);
+void rf_memory_invalidate(rfvm_t *vm);
+gboolean rf_memory_free_page(rfvm_t *vm, int pid);
+unsigned int rf_memory_evict(rfvm_t *vm);
+rfsz_t rf_memory_read_range(rfvm_t *vm, rfp_t p, rfword_t *buf, rfsz_t n, struct rfth_tlb *tlb);
+rfsz_t rf_memory_write_range(rfvm_t *vm, rfp_t p, const rfword_t *data, rfsz_t n, struct rfth_tlb *tlb);
 unsigned int rf_get_num_threads(rfvm_t *vm);
 rfth_t *rf_get_thread(rfvm_t *vm, unsigned int i);
 unsigned int rf_get_memory_usage(rfvm_t *vm);
+void rf_get_tlb_stats(rfvm_t *vm, unsigned long *hits, unsigned long *misses);
 rfsz_t rf_load_data(rfvm_t *vm, rfp_t p, const rfword_t *data, rfsz_t n);
 int rf_load_program(rfvm_t *vm, const char *filename, rfp_t p);
+rfimg_t *rf_image_compile(const char *filename);
+rfimg_t *rf_image_load(const char *filename);
+gboolean rf_image_store(rfimg_t *img, const char *filename);
+void rf_image_free(rfimg_t *img);
+unsigned int rf_seed_population(rfvm_t *vm, rfimg_t **images, unsigned int num_images, unsigned int n, rfp_t mu, rfsz_t sigma);
 gboolean rf_vm_store(rfvm_t *vm, const char *filename);
+gboolean rf_vm_load(rfvm_t *vm, const char *filename);
 
 
 #endif /* _rf_H_ */
@@ -0,0 +1,68 @@
+/* stack.h - stack operations
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * Pushes ('^') copy the word at DP below SP, pops ('V') copy the word at SP
+ * to DP, '$' sets SP (and the stack base) to DP. Since SP is usually set near
+ * DP, both tend to be on the same page, which is then looked up once (see
+ * rf_memory_move_fast()).
+ *
+ * Runs of the same stack operation (e.g. '^^^^' to get scratch space) are
+ * run at once by the trace engines, after the interpreter ran the first one.
+ * Like traces, a run stops before the next scheduled mutation and its writes
+ * stay outside of the run, so the result is exactly the same as with the
+ * interpreter.
+ *
+ * The stack is also watched: the depth is the number of words SP is below
+ * the base set by the last '$' (or the initial SP), pops above the base are
+ * counted as underflows. Pushes and pops of traced loops are counted, but
+ * only their final SP is checked.
+ */
+
+
+
+#ifndef _STACK_H_
+#define _STACK_H_
+
+#include <glib.h>
+
+#include "replifuck.h"
+
+
+/* Count depth of thread's stack (after pushes) */
+static inline void rf_stack_push_bounds(rfvm_t *vm, rfth_t *thread) {
+  if (thread->sp<thread->sb && (rfsz_t)(thread->sb-thread->sp)>vm->stack.max_depth) {
+    vm->stack.max_depth = (rfsz_t)(thread->sb-thread->sp);
+  }
+}
+
+/* Count underflow of thread's stack (after pops) */
+static inline void rf_stack_pop_bounds(rfvm_t *vm, rfth_t *thread) {
+  if (thread->sp>thread->sb) {
+    vm->stack.underflows++;
+  }
+}
+
+
+unsigned int rf_stack_run(rfvm_t *vm, rfth_t *thread, unsigned int n);
+
+
+#endif /* _STACK_H_ */
@@ -0,0 +1,99 @@
+/* include/sweep.h - parameter sweeps in worker processes
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * A sweep runs the same programs under every combination of seeds and
+ * mutation rates. Programs are loaded once, then a worker process is forked
+ * for each combination, up to a number of jobs at a time. Workers run their
+ * VM without TUI for a number of cycles (or until all threads are dead, or a
+ * steady state is detected, if runs are monitored, see monitor.h) and send
+ * their results back through a pipe. Results are printed as a table of
+ * runs and a table aggregated over seeds.
+ */
+
+
+
+#ifndef _SWEEP_H_
+#define _SWEEP_H_
+
+#include <glib.h>
+#include <stdio.h>
+
+#include "replifuck.h"
+
+
+/* Default number of cycles per run */
+#define RFSWEEP_CYCLES 10000
+
+/* Parameters of a sweep */
+struct rfsweep {
+  /* seeds: first seed & number of seeds (consecutive) */
+  unsigned long seed;
+  unsigned int num_seeds;
+
+  /* mutation rates (with double, the configured rate if empty) */
+  GArray *rates_instr;
+  GArray *rates_mem;
+  GArray *rates_kill;
+
+  /* cycles per run */
+  unsigned int cycles;
+
+  /* max. number of workers at a time (0 for number of processors) */
+  unsigned int jobs;
+};
+
+/* Result of a run */
+struct rfsweep_result {
+  /* parameters */
+  unsigned long seed;
+  double rate_instr;
+  double rate_mem;
+  double rate_kill;
+
+  /* worker failed (parameters are set anyway) */
+  gboolean failed;
+
+  /* cycles run (fewer than configured, if all threads died or a steady
+   * state was detected) & state of the run (see enum rfmonitor_state)
+   */
+  unsigned int clock;
+  int state;
+
+  /* census at the end & max. number of threads */
+  unsigned int threads;
+  unsigned int max_threads;
+  unsigned int pages;
+
+  /* number of threads created & executed instructions */
+  guint32 births;
+  guint64 instructions;
+
+  /* wall clock time of the run in seconds */
+  double seconds;
+};
+
+
+gboolean rf_sweep_parse_rates(GArray *rates, const char *list);
+GArray *rf_sweep_run(const rfconf_t *conf, const struct rfsweep *sweep, rfimg_t **images, unsigned int num_images);
+void rf_sweep_print(GArray *results, FILE *fd);
+
+
+#endif /* _SWEEP_H_ */
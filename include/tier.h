@@ -0,0 +1,94 @@
+/* tier.h - hot & cold tiers of pages
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ *
+ * Pages in memory are sorted into tiers every tier_interval cycles. A page's
+ * heat is halved at each pass and raised by its writes since the last pass
+ * and by each thread whose IP, DP or SP is on it.
+ *
+ * Hot pages are moved into an arena: a contiguous range of page slots (on
+ * huge pages, where available), so that the words threads are working on
+ * are close together. Pages are moved back when they cool down.
+ *
+ * Pages which were cold for RFTIER_COLD passes are packed, if they were
+ * written (clean pages are evicted instead, see rf_memory_evict()). Their
+ * words are XORed with their initial words (see rf_rand_page_words()), so
+ * that words which were never written become 0, and runs of 0s are left
+ * out. A packed page stays in the memory tree with a NULL data pointer and
+ * is unpacked when it's looked up again. Pages are only moved or packed if
+ * they aren't shared with a clone, exported or in the memory window.
+ *
+ * NOTE: A VM runs in a single thread, so pages are placed on the NUMA node of
+ *       that thread by the kernel (first touch). The arena is committed by
+ *       the thread which promotes pages into it.
+ */
+
+
+
+#ifndef _TIER_H_
+#define _TIER_H_
+
+#include <glib.h>
+
+#include "replifuck.h"
+
+
+/* Heat for each thread whose IP, DP or SP is on a page & max. heat from
+ * writes per pass
+ */
+#define RFTIER_TOUCH 8
+#define RFTIER_MAX_WRITES 64
+
+/* Heat a page is promoted to the arena at (it's demoted below half of it) */
+#define RFTIER_HOT 16
+
+/* Number of passes without heat after which a written page is packed */
+#define RFTIER_COLD 4
+
+/* Min. number of 0s (after XOR) which are left out of packed pages */
+#define RFTIER_MIN_RUN 8
+
+
+/* Arena of hot pages */
+struct rfarena {
+  /* Slots (page size words each) & size of mapping in bytes */
+  rfword_t *data;
+  size_t size;
+
+  /* Number of slots, free slots & their number */
+  unsigned int num_slots;
+  unsigned int *free;
+  unsigned int num_free;
+};
+
+
+gboolean rf_tier_init(rfvm_t *vm);
+void rf_tier_free(rfvm_t *vm);
+void rf_tier_release(rfpage_t *page);
+unsigned int rf_tier_num_hot(rfvm_t *vm);
+void rf_tier_read(rfvm_t *vm, int pid, const rfpage_t *page, rfword_t *data);
+rfpage_t *rf_tier_unpack(rfvm_t *vm, int pid, rfpage_t *page);
+void rf_tier_flush(rfvm_t *vm);
+void rf_tier_update(rfvm_t *vm);
+
+
+#endif /* _TIER_H_ */
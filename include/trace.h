@@ -0,0 +1,132 @@
+/* include/trace.h - trace cache for replifuck
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Hot loops (innermost '[' ... ']' regions, whose back-edge was taken often)
+ * are translated into a short list of pre-decoded operations with fused
+ * pointer movement and cell deltas. Clear loops ('[-]') and copy/multiply
+ * loops ('[->+>++<<]') are run in closed form, all others iteration by
+ * iteration. A trace only runs as long as no mutation is scheduled and its
+ * own writes stay outside of the loop, so the result is exactly the same as
+ * with the interpreter. Writes to a traced loop drop its trace.
+ */
+
+
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <glib.h>
+
+#include "replifuck.h"
+
+
+/* Number of taken back-edges until a loop is compiled */
+#define RFTRACE_HOT 32
+
+/* Max. length of loop body and number of operations */
+#define RFTRACE_MAX_LENGTH 64
+#define RFTRACE_MAX_OPS    32
+
+/* Max. number of cached loops (cache is flushed when full) */
+#define RFTRACE_MAX_ENTRIES 0x10000
+
+
+/* Trace states */
+enum rftrace_state {
+  /* back-edges are counted */
+  RFTRACE_COLD,
+  /* operations are valid */
+  RFTRACE_COMPILED,
+  /* loop body can't be traced */
+  RFTRACE_UNTRACEABLE
+};
+
+/* Loop idioms */
+enum rftrace_idiom {
+  /* run iteration by iteration */
+  RFTRACE_GENERIC,
+  /* '[-]' or '[+]' */
+  RFTRACE_CLEAR,
+  /* no pointer movement, constant deltas, counter is decremented/incremented by 1 */
+  RFTRACE_MULTIPLY
+};
+
+/* Operations, offsets are relative to DP at the start of an iteration */
+enum rftrace_opcode {
+  /* add delta to word at offset */
+  RFTRACE_ADD,
+  /* push word at offset */
+  RFTRACE_PUSH,
+  /* pop word to offset */
+  RFTRACE_POP
+};
+struct rftrace_op {
+  int opcode;
+  int off;
+  int delta;
+};
+
+/* Compiled loop */
+struct rftrace {
+  /* Position of '[' and matching ']' */
+  rfp_t start;
+  rfp_t end;
+
+  /* State (see enum rftrace_state) and number of taken back-edges */
+  int state;
+  unsigned int hits;
+
+  /* Idiom (see enum rftrace_idiom) */
+  int idiom;
+
+  /* Instructions per iteration (including '[' and ']') */
+  unsigned int cost;
+
+  /* DP movement per iteration & delta of the counter word (multiply idiom) */
+  int shift;
+  int step;
+
+  /* Range of DP offsets written, number of pushes & pops per iteration */
+  gboolean writes_dp;
+  int min_off;
+  int max_off;
+  unsigned int pushes;
+  unsigned int pops;
+
+  /* Operations */
+  unsigned int num_ops;
+  struct rftrace_op ops[RFTRACE_MAX_OPS];
+
+  /* Number of runs and native code (see native.h) */
+  unsigned int runs;
+  struct rfnative *native;
+};
+
+
+void rf_trace_init(rfvm_t *vm);
+void rf_trace_flush(rfvm_t *vm);
+void rf_trace_destroy(rfvm_t *vm);
+void rf_trace_invalidate(rfvm_t *vm, rfpage_t *page, rfp_t first, rfp_t last);
+void rf_trace_invalidate_page(rfvm_t *vm, rfpage_t *page);
+unsigned int rf_trace_run(rfvm_t *vm, rfth_t *thread, unsigned int n);
+
+
+#endif /* _TRACE_H_ */
@@ -29,11 +29,133 @@
 #include <stdio.h>
 
 #include "replifuck.h"
+#include "inspect.h"
+#include "monitor.h"
+#include "writer.h"
+
+
+/* Frames per second */
+#define TUI_FPS 25
+
+/* Max. time the simulation thread runs without publishing a snapshot (us) */
+#define TUI_BATCH_TIME 10000
+
+/* Max. target rate (cycles per second), doubling it further means full speed */
+#define TUI_MAX_RATE 0x100000
+
+/* Width of memory view */
+#define TUI_MEM_VIEW 76
+
+/* Rows & cells of memory overview (each cell summarizes some pages) */
+#define TUI_OVERVIEW_ROWS 7
+#define TUI_OVERVIEW_CELLS (TUI_OVERVIEW_ROWS*TUI_MEM_VIEW)
+
+/* Max. number of pages per cell */
+#define TUI_MAX_ZOOM 0x100000
+
+/* Characters for levels of overview cells, from low to high */
+#define TUI_SHADES ".,:-=+*#%@"
+#define TUI_NUM_SHADES 10
+
+/* Level of overview cells without pages */
+#define TUI_NO_PAGES 0xFF
+
+/* What overview cells show */
+enum tui_metric {
+  /* number of words that are instructions */
+  TUI_METRIC_OPCODES,
+  /* number of writes since last frame */
+  TUI_METRIC_WRITES,
+  /* number of threads with their IP on the pages */
+  TUI_METRIC_THREADS,
+  /* number of signature matches */
+  TUI_METRIC_SIGNATURES,
+  TUI_NUM_METRICS
+};
 
 
 typedef struct tui_S tui_t;
 
 
+/* States written in the background (see writer.h) */
+struct tui_store {
+  /* number of states being written, stored & failed */
+  unsigned int num_pending;
+  unsigned int num_stored;
+  unsigned int num_failed;
+
+  /* last finished state: whether it was stored, its clock & time to write it */
+  gboolean stored;
+  unsigned int clock;
+  double seconds;
+};
+
+
+/* What the TUI wants to see & how fast the simulation should run */
+struct tui_request {
+  gboolean autostep;
+  unsigned int rate;
+  int current_thread;
+  rfp_t mem_view;
+  rfp_t mem_p;
+
+  /* show overview instead of words, pages per cell & metric */
+  gboolean overview;
+  unsigned int zoom;
+  int metric;
+};
+
+/* State of the VM, as rendered by the TUI. Filled by the simulation thread */
+struct tui_snapshot {
+  struct tui_request request;
+
+  /* VM */
+  unsigned int clock;
+  unsigned int num_threads;
+  unsigned int num_reaped;
+  unsigned int memory_usage;
+  unsigned int num_mutations[3];
+  guint64 instructions;
+  guint64 traced_instructions;
+  unsigned int num_traces;
+  unsigned long tlb_hits;
+  unsigned long tlb_misses;
+  rfsz_t stack_max_depth;
+  guint64 stack_underflows;
+
+  /* Measured rate (cycles per second) */
+  double rate;
+
+  /* State of the run, clock it was detected at & whether the VM was stored
+   * then (if monitored)
+   */
+  int monitor_state;
+  unsigned int monitor_clock;
+  gboolean checkpoint_stored;
+
+  /* States written in the background */
+  struct tui_store store;
+
+  /* Selected thread (if there are threads) */
+  struct {
+    unsigned int clock;
+    rfp_t ip, dp, sp, sb;
+    rfword_t at_ip, at_dp, at_sp;
+    unsigned long tlb_hits;
+    unsigned long tlb_misses;
+  } thread;
+
+  /* Memory view & selected word */
+  rfword_t view[TUI_MEM_VIEW];
+  rfword_t at_mem_p;
+
+  /* Overview: first page & levels of cells (TUI_NO_PAGES or below
+   * TUI_NUM_SHADES, relative to the highest cell)
+   */
+  int overview_first;
+  guint8 overview[TUI_OVERVIEW_CELLS];
+};
+
 struct tui_S {
   WINDOW *win_main;
   WINDOW *win_vm;
@@ -42,19 +164,63 @@ struct tui_S {
 
   gboolean running;
   gboolean autostep;
-  unsigned int cycles_per_frame;
+
+  /* Target rate (cycles per second), 0 for full speed */
+  unsigned int rate;
 
   rfvm_t *vm;
   int current_thread;
   rfp_t mem_view;
   rfp_t mem_p;
-  struct rfth_page_cache page_cache;
+  struct rfth_tlb tlb;
+
+  /* Overview (see struct tui_request) */
+  gboolean overview;
+  unsigned int zoom;
+  int metric;
+
+  /* Writes per overview cell at the last snapshot & the first page & zoom
+   * they were counted for (zoom is 0 if there are none). Used by the
+   * simulation thread, writes are shown as the difference.
+   */
+  guint64 overview_writes[TUI_OVERVIEW_CELLS];
+  int overview_writes_first;
+  unsigned int overview_writes_zoom;
+
+  /* Inspection server (polled by simulation thread) or NULL */
+  struct rfinspect *inspect;
+
+  /* Run monitor (updated by simulation thread) or NULL. When it detects a
+   * state, autostep is stopped and the VM is stored to checkpoint (if not
+   * NULL). The TUI stops autostep when it sees the state.
+   */
+  struct rfmonitor *monitor;
+  const char *checkpoint;
+  gboolean checkpoint_stored;
+  gboolean monitor_seen;
+
+  /* Writer of VM states (F8 & checkpoints), polled by simulation thread, the
+   * states it wrote & number of failures the TUI has seen
+   */
+  struct rfwriter *writer;
+  struct tui_store store;
+  unsigned int store_failures_seen;
+
+  /* Simulation thread. It owns the VM, others must hold vm_lock to use it */
+  GThread *sim;
+  GMutex vm_lock;
+
+  /* Latest request & double-buffered snapshots (protected by snapshot_lock) */
+  GMutex snapshot_lock;
+  struct tui_request request;
+  struct tui_snapshot snapshots[2];
+  unsigned int front;
 };
 
 
 int tui_init(tui_t *tui, rfvm_t *vm);
 void tui_finalize(tui_t *tui);
-void tui_win_main(tui_t *tui);
+void tui_win_main(tui_t *tui, const struct tui_snapshot *snapshot);
 void tui_memview_goto(tui_t *tui, rfp_t p);
 gboolean tui_really_quit(tui_t *tui);
 void tui_show_help(tui_t *tui);
@@ -0,0 +1,71 @@
+/* window.h - memory window backed by reserved address space
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * The memory window is an alternative store for the pages around 0. Address
+ * space for all of its words is reserved without access, so each word has a
+ * fixed position and is read with a bounds check instead of a page lookup.
+ * When a page is touched first, the fault handler (SIGSEGV) commits it and
+ * fills it with its initial words (see rf_rand_page_words()), so the OS
+ * manages which pages are resident. Pages outside of the window are kept in
+ * the memory tree as usual.
+ *
+ * Pages of the window still get a page structure (summary, traces, writers)
+ * when they're looked up, e.g. to be written. Like virtual pages it's put
+ * into the memory tree when it's written. The window owns these pages: when
+ * they're removed from memory they're kept until they're discarded, which
+ * drops their words, too. They're never shared with clones and aren't put
+ * into the shared memory file of inspection servers.
+ */
+
+
+
+#ifndef _WINDOW_H_
+#define _WINDOW_H_
+
+#include <glib.h>
+
+#include "replifuck.h"
+
+
+/* Max. number of VMs with windows in a process */
+#define RFWINDOW_MAX_VMS 64
+
+
+/* Check if page is in the window */
+static inline gboolean rf_window_has_page(rfvm_t *vm, int pid) {
+  return (unsigned int)(pid-vm->window.first)<vm->window.num_pages;
+}
+
+/* Check if position p is in the window */
+static inline gboolean rf_window_has(rfvm_t *vm, rfp_t p) {
+  return (rfsz_t)(p-vm->window.start)<vm->window.length;
+}
+
+
+gboolean rf_window_init(rfvm_t *vm, unsigned int num_pages);
+void rf_window_free(rfvm_t *vm);
+rfpage_t *rf_window_page(rfvm_t *vm, int pid);
+void rf_window_discard(rfvm_t *vm, int pid);
+void rf_window_evict(rfvm_t *vm);
+
+
+#endif /* _WINDOW_H_ */
@@ -0,0 +1,86 @@
+/* include/writer.h - background writer of VM states
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Storing a VM (see rf_vm_store()) writes every page, so the simulation
+ * would be paused for the whole write. A writer stores VMs in the
+ * background instead: the VM is cloned (pages are shared copy-on-write, see
+ * rf_vm_clone()), so it's only paused for cloning, and the clone is stored
+ * by the writer thread. Pages the VM writes in the meantime are copied.
+ *
+ * A state is written to a file with RFWRITER_SUFFIX appended and renamed
+ * when it's complete, so an older state with that name is only replaced by a
+ * complete one. Finished stores (stored or failed) are polled by the owner
+ * of the VM, which frees the clone then: pages the VM freed meanwhile are
+ * freed with it, and they may have to be released into the VM's memory file
+ * (see inspect.h). To bound the memory held by clones, only
+ * RFWRITER_MAX_PENDING states are written at a time.
+ */
+
+
+
+#ifndef _WRITER_H_
+#define _WRITER_H_
+
+#include <glib.h>
+
+#include "replifuck.h"
+
+
+/* Max. number of states being written at a time */
+#define RFWRITER_MAX_PENDING 2
+
+/* Suffix of files being written */
+#define RFWRITER_SUFFIX ".part"
+
+/* State to store */
+struct rfwriter_job {
+  /* clone to store (NULL once polled) & file name */
+  rfvm_t *vm;
+  gchar *filename;
+
+  /* clock of the VM when it was cloned */
+  unsigned int clock;
+
+  /* whether it was stored & time it took to write in seconds */
+  gboolean stored;
+  double seconds;
+};
+
+/* Writer of VM states */
+struct rfwriter {
+  /* writer thread, states to store & finished states */
+  GThread *thread;
+  GAsyncQueue *jobs;
+  GAsyncQueue *done;
+
+  /* number of states stored, but not polled yet */
+  unsigned int num_pending;
+};
+
+
+struct rfwriter *rf_writer_new(void);
+void rf_writer_free(struct rfwriter *writer);
+gboolean rf_writer_store(struct rfwriter *writer, rfvm_t *vm, const char *filename);
+struct rfwriter_job *rf_writer_poll(struct rfwriter *writer);
+void rf_writer_job_free(struct rfwriter_job *job);
+
+
+#endif /* _WRITER_H_ */
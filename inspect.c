@@ -0,0 +1,447 @@
+/* inspect.c - inspection server for replifuck
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "replifuck.h"
+#include "inspect.h"
+#include "provenance.h"
+#include "tier.h"
+
+
+/* Connected client */
+struct rfinspect_client {
+  int fd;
+
+  /* Received & pending output */
+  GString *in;
+  GString *out;
+
+  /* Offset in output at which the memory file is passed (-1 if it isn't) */
+  gssize fd_at;
+};
+
+
+static void rf_set_errno_error(GError **error, const char *what) {
+  int errsv = errno;
+
+  g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv), "%s: %s", what, g_strerror(errsv));
+}
+
+
+/* Create shared memory file for max_pages pages. It's sparse, so unused
+ * slots cost nothing.
+ */
+struct rfexport *rf_export_new(unsigned int page_size, unsigned int max_pages, GError **error) {
+  struct rfexport *export;
+  gsize size;
+  int fd;
+  void *base;
+
+  size = (gsize)page_size*max_pages*sizeof(rfword_t);
+
+  fd = memfd_create("replifuck", MFD_CLOEXEC);
+  if (fd<0) {
+    rf_set_errno_error(error, "Can't create memory file");
+    return NULL;
+  }
+  if (ftruncate(fd, size)<0) {
+    rf_set_errno_error(error, "Can't resize memory file");
+    close(fd);
+    return NULL;
+  }
+  base = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base==MAP_FAILED) {
+    rf_set_errno_error(error, "Can't map memory file");
+    close(fd);
+    return NULL;
+  }
+
+  export = g_new0(struct rfexport, 1);
+  export->refs = 1;
+  export->fd = fd;
+  export->base = (rfword_t*)base;
+  export->size = size;
+  export->page_size = page_size;
+  export->max_pages = max_pages;
+  export->free_slots = g_array_new(FALSE, FALSE, sizeof(unsigned int));
+
+  return export;
+}
+
+
+/* Release reference to shared memory file */
+void rf_export_unref(struct rfexport *export) {
+  if (g_atomic_int_dec_and_test(&export->refs)) {
+    munmap(export->base, export->size);
+    close(export->fd);
+    g_array_free(export->free_slots, TRUE);
+    g_free(export);
+  }
+}
+
+
+/* Get slot for a page. Returns NULL if all slots are used */
+rfword_t *rf_export_alloc(struct rfexport *export) {
+  unsigned int slot;
+
+  if (export->free_slots->len>0) {
+    slot = g_array_index(export->free_slots, unsigned int, export->free_slots->len-1);
+    g_array_set_size(export->free_slots, export->free_slots->len-1);
+  }
+  else if (export->num_slots<export->max_pages) {
+    slot = export->num_slots++;
+  }
+  else {
+    return NULL;
+  }
+
+  export->num_used++;
+
+  return export->base+(gsize)slot*export->page_size;
+}
+
+
+/* Return slot of a freed page */
+void rf_export_release(struct rfexport *export, rfword_t *data) {
+  unsigned int slot = (unsigned int)rf_export_slot(export, data);
+
+  g_array_append_val(export->free_slots, slot);
+  export->num_used--;
+}
+
+
+/* Get slot of page data. Returns -1 if it isn't in the memory file */
+int rf_export_slot(struct rfexport *export, const rfword_t *data) {
+  if (export==NULL || data<export->base || data>=export->base+(gsize)export->max_pages*export->page_size) {
+    return -1;
+  }
+  else {
+    return (int)((data-export->base)/export->page_size);
+  }
+}
+
+
+/* Iterator: moves page data into the memory file (words of the memory
+ * window stay in place)
+ */
+static gboolean rf_export_attach_iter(void *key, void *value, void *userdata) {
+  struct rfexport *export = (struct rfexport*)userdata;
+  rfpage_t *page = (rfpage_t*)value;
+  rfword_t *data;
+
+  if (page->export==NULL && !page->window) {
+    data = rf_export_alloc(export);
+    if (data==NULL) {
+      return TRUE;
+    }
+    memcpy(data, page->data, sizeof(rfword_t)*export->page_size);
+    page->data = data;
+    page->export = export;
+  }
+
+  return FALSE;
+}
+
+/* Export pages of VM. Pages created later are put into the memory file, too.
+ * NOTE: Only one export can be attached to a VM. Clones share it.
+ */
+void rf_export_attach(struct rfexport *export, rfvm_t *vm) {
+  g_return_if_fail(vm->export==NULL && export->page_size==vm->page_size);
+
+  g_atomic_int_inc(&export->refs);
+  vm->export = export;
+  rf_tier_flush(vm);
+  g_tree_foreach(vm->memory, rf_export_attach_iter, export);
+}
+
+
+
+static void rf_inspect_client_free(struct rfinspect_client *client) {
+  close(client->fd);
+  g_string_free(client->in, TRUE);
+  g_string_free(client->out, TRUE);
+  g_free(client);
+}
+
+
+/* Start server listening at path. Pages of VM are exported from now on */
+struct rfinspect *rf_inspect_new(rfvm_t *vm, const char *path, unsigned int max_pages, GError **error) {
+  struct rfinspect *inspect;
+  struct rfexport *export;
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(path)>=sizeof(addr.sun_path)) {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NAMETOOLONG, "Socket path too long: %s", path);
+    return NULL;
+  }
+
+  /* listen */
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+  if (fd<0) {
+    rf_set_errno_error(error, "Can't create socket");
+    return NULL;
+  }
+  unlink(path);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr))<0 || listen(fd, 8)<0) {
+    rf_set_errno_error(error, path);
+    close(fd);
+    return NULL;
+  }
+
+  /* export pages */
+  if (vm->export==NULL) {
+    export = rf_export_new(vm->page_size, max_pages, error);
+    if (export==NULL) {
+      close(fd);
+      unlink(path);
+      return NULL;
+    }
+    rf_export_attach(export, vm);
+    rf_export_unref(export);
+  }
+
+  inspect = g_new0(struct rfinspect, 1);
+  inspect->vm = vm;
+  inspect->fd = fd;
+  inspect->path = g_strdup(path);
+
+  return inspect;
+}
+
+
+/* Stop server. Pages stay in the memory file */
+void rf_inspect_free(struct rfinspect *inspect) {
+  g_slist_free_full(inspect->clients, (GDestroyNotify)rf_inspect_client_free);
+  close(inspect->fd);
+  unlink(inspect->path);
+  g_free(inspect->path);
+  g_free(inspect);
+}
+
+
+/* Iterator: lists exported pages */
+static gboolean rf_inspect_pages_iter(void *key, void *value, void *userdata) {
+  rfpage_t *page = (rfpage_t*)value;
+
+  g_string_append_printf((GString*)userdata, "page %d %d\n", GPOINTER_TO_INT(key), rf_export_slot(page->export, page->data));
+
+  return FALSE;
+}
+
+/* Run command and append its answer to the output */
+static void rf_inspect_command(struct rfinspect *inspect, struct rfinspect_client *client, const char *cmd) {
+  rfvm_t *vm = inspect->vm;
+  rfth_t *thread;
+  unsigned long tlb_hits, tlb_misses;
+  unsigned int i, first;
+  guint32 *writers;
+  int pid;
+
+  if (strcmp(cmd, "info")==0) {
+    rf_get_tlb_stats(vm, &tlb_hits, &tlb_misses);
+    g_string_append_printf(client->out,
+                           "clock %u\n"
+                           "instructions %" G_GUINT64_FORMAT "\n"
+                           "threads %u\n"
+                           "pages %d\n"
+                           "page_size %u\n"
+                           "exported %u\n"
+                           "unshared %u\n"
+                           "evicted %u\n"
+                           "virtual_generated %u\n"
+                           "virtual_materialized %u\n"
+                           "mutations_instr %u\n"
+                           "mutations_mem %u\n"
+                           "mutations_kill %u\n"
+                           "reaped %u\n"
+                           "traced_instructions %" G_GUINT64_FORMAT "\n"
+                           "native_instructions %" G_GUINT64_FORMAT "\n"
+                           "tlb_hits %lu\n"
+                           "tlb_misses %lu\n",
+                           vm->clock, vm->instructions, rf_get_num_threads(vm),
+                           g_tree_nnodes(vm->memory), vm->page_size,
+                           vm->export!=NULL ? vm->export->num_used : 0,
+                           vm->num_unshared, vm->num_evicted,
+                           vm->virtual_pages.num_generated,
+                           vm->virtual_pages.num_materialized, vm->mutations.num_instr,
+                           vm->mutations.num_mem, vm->mutations.num_kill,
+                           vm->reaper.num_reaped, vm->trace.instructions,
+                           vm->trace.native_instructions, tlb_hits, tlb_misses);
+  }
+  else if (strcmp(cmd, "threads")==0) {
+    for (i=0; i<vm->threads->len; i++) {
+      thread = g_ptr_array_index(vm->threads, i);
+      g_string_append_printf(client->out, "thread %u %ld %ld %ld %u %u %u\n", i, thread->ip, thread->dp, thread->sp, thread->clock, thread->errors, thread->id);
+    }
+  }
+  else if (strcmp(cmd, "pages")==0) {
+    g_tree_foreach(vm->memory, rf_inspect_pages_iter, client->out);
+  }
+  else if (sscanf(cmd, "writers %d", &pid)==1) {
+    writers = g_new(guint32, vm->page_size);
+    if (rf_provenance_get(vm, pid, writers)) {
+      /* runs of words with the same writer */
+      for (i=0, first=0; i<vm->page_size; i++) {
+        if (i+1==vm->page_size || writers[i+1]!=writers[first]) {
+          g_string_append_printf(client->out, "writers %u %u %u\n", first, i, writers[first]);
+          first = i+1;
+        }
+      }
+    }
+    else {
+      g_string_append_printf(client->out, "error no such page: %d\n", pid);
+    }
+    g_free(writers);
+  }
+  else if (strcmp(cmd, "map")==0 && vm->export==NULL) {
+    g_string_append(client->out, "error memory isn't exported\n");
+  }
+  else if (strcmp(cmd, "map")==0) {
+    client->fd_at = client->out->len;
+    g_string_append_printf(client->out, "map %" G_GSIZE_FORMAT " %u %u\n", vm->export->size, vm->page_size, (unsigned int)sizeof(rfword_t));
+  }
+  else {
+    g_string_append_printf(client->out, "error unknown command: %s\n", cmd);
+  }
+
+  g_string_append_c(client->out, '\n');
+}
+
+
+/* Send pending output without blocking. Returns FALSE, if the client is gone */
+static gboolean rf_inspect_flush(struct rfinspect *inspect, struct rfinspect_client *client) {
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char control[CMSG_SPACE(sizeof(int))];
+  gssize n;
+
+  while (client->out->len>0) {
+    if (client->fd_at==0) {
+      /* pass memory file along with the first byte of the answer */
+      iov.iov_base = client->out->str;
+      iov.iov_len = client->out->len;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &inspect->vm->export->fd, sizeof(int));
+      n = sendmsg(client->fd, &msg, MSG_DONTWAIT|MSG_NOSIGNAL);
+    }
+    else {
+      n = send(client->fd, client->out->str, client->fd_at>0 ? (gsize)client->fd_at : client->out->len, MSG_DONTWAIT|MSG_NOSIGNAL);
+    }
+
+    if (n<0) {
+      return errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR;
+    }
+
+    g_string_erase(client->out, 0, n);
+    if (client->fd_at>=0) {
+      /* sends before the answer stop at it */
+      client->fd_at = client->fd_at>0 ? client->fd_at-n : -1;
+    }
+  }
+
+  return TRUE;
+}
+
+
+/* Receive & run commands. Returns FALSE, if the client is gone */
+static gboolean rf_inspect_client_poll(struct rfinspect *inspect, struct rfinspect_client *client) {
+  char buf[RFINSPECT_MAX_LINE];
+  char *end;
+  gssize n;
+
+  for (;;) {
+    n = recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n==0) {
+      return FALSE;
+    }
+    else if (n<0) {
+      if (errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR) {
+        break;
+      }
+      return FALSE;
+    }
+    g_string_append_len(client->in, buf, n);
+  }
+
+  /* run complete commands, but only one memory file can be pending */
+  while (client->fd_at<0 && (end = memchr(client->in->str, '\n', client->in->len))!=NULL) {
+    *end = '\0';
+    rf_inspect_command(inspect, client, g_strstrip(client->in->str));
+    g_string_erase(client->in, 0, end-client->in->str+1);
+  }
+  if (client->in->len>RFINSPECT_MAX_LINE) {
+    return FALSE;
+  }
+
+  return rf_inspect_flush(inspect, client);
+}
+
+
+/* Accept clients & answer their commands. Never blocks, so this can be called
+ * between cycles.
+ */
+void rf_inspect_poll(struct rfinspect *inspect) {
+  struct rfinspect_client *client;
+  GSList *l, *next;
+  int fd;
+
+  while ((fd = accept4(inspect->fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC))>=0) {
+    client = g_new0(struct rfinspect_client, 1);
+    client->fd = fd;
+    client->in = g_string_new(NULL);
+    client->out = g_string_new(NULL);
+    client->fd_at = -1;
+    inspect->clients = g_slist_prepend(inspect->clients, client);
+  }
+
+  for (l=inspect->clients; l!=NULL; l=next) {
+    next = l->next;
+    client = (struct rfinspect_client*)l->data;
+    if (!rf_inspect_client_poll(inspect, client)) {
+      inspect->clients = g_slist_delete_link(inspect->clients, l);
+      rf_inspect_client_free(client);
+    }
+  }
+}
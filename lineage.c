@@ -0,0 +1,214 @@
+/* lineage.c - lineage of threads
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "replifuck.h"
+#include "page.h"
+#include "lineage.h"
+
+
+/* Create lineage with up to max_records records */
+struct rflineage *rf_lineage_new(unsigned int max_records) {
+  struct rflineage *lineage;
+
+  lineage = g_new0(struct rflineage, 1);
+  lineage->records = g_array_sized_new(FALSE, FALSE, sizeof(struct rflineage_record), MIN(max_records, 0x1000));
+  lineage->max_records = MAX(max_records, 2);
+
+  return lineage;
+}
+
+
+/* Copy lineage (e.g. for a clone of the VM) */
+struct rflineage *rf_lineage_copy(struct rflineage *lineage) {
+  struct rflineage *copy;
+
+  copy = (struct rflineage*)g_memdup(lineage, sizeof(struct rflineage));
+  copy->records = g_array_sized_new(FALSE, FALSE, sizeof(struct rflineage_record), lineage->records->len);
+  g_array_append_vals(copy->records, lineage->records->data, lineage->records->len);
+
+  return copy;
+}
+
+
+/* Free lineage */
+void rf_lineage_free(struct rflineage *lineage) {
+  g_array_free(lineage->records, TRUE);
+  g_free(lineage);
+}
+
+
+/* Find index of record by ID. Returns -1 if it isn't there */
+static int rf_lineage_find(struct rflineage *lineage, guint32 id) {
+  struct rflineage_record *records = (struct rflineage_record*)lineage->records->data;
+  int lo = 0, hi = (int)lineage->records->len-1, mid;
+
+  while (lo<=hi) {
+    mid = lo+(hi-lo)/2;
+    if (records[mid].id<id) {
+      lo = mid+1;
+    }
+    else if (records[mid].id>id) {
+      hi = mid-1;
+    }
+    else {
+      return mid;
+    }
+  }
+
+  return -1;
+}
+
+
+/* Hash code of thread (FNV-1a). Pages aren't created, so that recording
+ * lineage doesn't change the simulation.
+ */
+guint32 rf_lineage_genotype(rfvm_t *vm, rfth_t *thread) {
+  guint32 hash = 2166136261U;
+  rfpage_t *page;
+  rfp_t p;
+  int pid;
+  unsigned int off;
+
+  for (p=thread->ip+1; p<=thread->ip+RFLINEAGE_MAX_GENOME; p++) {
+    rf_memory_get_pid_and_offset(p, vm->page_shift, &pid, &off);
+    page = rf_memory_peek_page(vm, pid, &thread->tlb);
+    if (page==NULL || page->data[off]==0) {
+      break;
+    }
+    hash = (hash^(guint8)page->data[off])*16777619U;
+  }
+
+  return hash;
+}
+
+
+/* Record new thread (with its genotype set), forked by parent (NULL if it
+ * wasn't forked)
+ */
+void rf_lineage_birth(rfvm_t *vm, rfth_t *thread, rfth_t *parent) {
+  struct rflineage *lineage = vm->lineage;
+  struct rflineage_record record;
+
+  if (lineage->records->len>=lineage->max_records) {
+    rf_lineage_prune(lineage);
+  }
+
+  record.id = thread->id;
+  record.parent = parent!=NULL ? parent->id : 0;
+  record.birth = vm->clock;
+  record.death = RFLINEAGE_ALIVE;
+  record.genotype = thread->genotype;
+  g_array_append_val(lineage->records, record);
+}
+
+
+/* Record death of thread */
+void rf_lineage_death(rfvm_t *vm, rfth_t *thread) {
+  int i;
+
+  i = rf_lineage_find(vm->lineage, thread->id);
+  if (i>=0) {
+    g_array_index(vm->lineage->records, struct rflineage_record, i).death = vm->clock;
+  }
+}
+
+
+/* Remove records of dead threads without living descendants. If more than
+ * half of the records are left, the oldest are dropped.
+ */
+void rf_lineage_prune(struct rflineage *lineage) {
+  struct rflineage_record *records = (struct rflineage_record*)lineage->records->data;
+  unsigned int len = lineage->records->len, i, j, keep_max;
+  guint8 *keep;
+  int parent;
+
+  /* mark living threads & their ancestors (parents come before children) */
+  keep = g_new0(guint8, len);
+  for (i=len; i-->0;) {
+    if (records[i].death==RFLINEAGE_ALIVE) {
+      keep[i] = TRUE;
+    }
+    if (keep[i] && records[i].parent!=0) {
+      parent = rf_lineage_find(lineage, records[i].parent);
+      if (parent>=0) {
+        keep[parent] = TRUE;
+      }
+    }
+  }
+
+  for (i=0, j=0; i<len; i++) {
+    j += keep[i];
+  }
+  lineage->num_pruned += len-j;
+
+  /* drop oldest records, if there are too many left */
+  keep_max = lineage->max_records/2;
+  for (i=0; j>keep_max; i++) {
+    if (keep[i]) {
+      keep[i] = FALSE;
+      j--;
+      lineage->num_dropped++;
+    }
+  }
+
+  /* compact */
+  for (i=0, j=0; i<len; i++) {
+    if (keep[i]) {
+      records[j++] = records[i];
+    }
+  }
+  g_array_set_size(lineage->records, j);
+
+  g_free(keep);
+}
+
+
+/* Export lineage to text file: one line "ID PARENT BIRTH DEATH GENOTYPE" per
+ * thread, DEATH is '-' for living threads
+ */
+gboolean rf_lineage_export(struct rflineage *lineage, const char *filename) {
+  FILE *fd;
+  struct rflineage_record *record;
+  unsigned int i;
+
+  fd = fopen(filename, "w");
+  if (fd==NULL) {
+    return FALSE;
+  }
+
+  fputs(RFLINEAGE_MAGIC, fd);
+  for (i=0; i<lineage->records->len; i++) {
+    record = &g_array_index(lineage->records, struct rflineage_record, i);
+    if (record->death==RFLINEAGE_ALIVE) {
+      fprintf(fd, "%u %u %u - %08x\n", record->id, record->parent, record->birth, record->genotype);
+    }
+    else {
+      fprintf(fd, "%u %u %u %u %08x\n", record->id, record->parent, record->birth, record->death, record->genotype);
+    }
+  }
+
+  return fclose(fd)==0;
+}
@@ -27,47 +27,410 @@
 #include <unistd.h>
 
 #include "replifuck.h"
+#include "reaper.h"
+#include "diff.h"
+#include "sweep.h"
+#include "bench.h"
+#include "inspect.h"
+#include "lineage.h"
+#include "monitor.h"
 #include "tui.h"
 
 
-#define INITIAL_POPULATION_SIZE 4
+/* Command line options. Options not given on command line are -1, so that
+ * they don't override the configuration file.
+ */
+static gchar *opt_config = NULL;
+static gchar *opt_compile = NULL;
+static gchar *opt_diff = NULL;
+static gint opt_diff_cycles = 10000;
+static gint opt_diff_interval = RFDIFF_INTERVAL;
+static gint opt_sweep = 0;
+static gchar *opt_sweep_rates_instr = NULL;
+static gchar *opt_sweep_rates_mem = NULL;
+static gchar *opt_sweep_rates_kill = NULL;
+static gint opt_sweep_cycles = RFSWEEP_CYCLES;
+static gint opt_sweep_jobs = 0;
+static gboolean opt_bench = FALSE;
+static gint opt_bench_cycles = RFBENCH_CYCLES;
+static gchar *opt_bench_baseline = NULL;
+static gchar *opt_bench_store = NULL;
+static gdouble opt_bench_tolerance = RFBENCH_TOLERANCE;
+static gint64 opt_seed = -1;
+static gint opt_page_size = -1;
+static gint opt_max_threads = -1;
+static gchar *opt_reaper = NULL;
+static gint opt_max_cycles = -1;
+static gchar *opt_scheduler = NULL;
+static gint opt_quantum = -1;
+static gint opt_budget = -1;
+static gchar *opt_engine = NULL;
+static gint opt_population = -1;
+static gint64 opt_spread = -1;
+static gdouble opt_rate_instr = -1.0;
+static gdouble opt_rate_mem = -1.0;
+static gdouble opt_rate_kill = -1.0;
+static gint opt_lineage = -1;
+static gchar *opt_lineage_file = NULL;
+static gboolean opt_provenance = FALSE;
+static gint opt_evict_interval = -1;
+static gint opt_window = -1;
+static gint opt_tier_interval = -1;
+static gint opt_tier_hot = -1;
+static gint opt_monitor = -1;
+static gdouble opt_monitor_tolerance = -1.0;
+static gdouble opt_monitor_fixation = -1.0;
+static gchar *opt_monitor_checkpoint = NULL;
+static gchar *opt_signature = NULL;
+static gchar *opt_inspect = NULL;
+static gint opt_inspect_pages = RFINSPECT_MAX_PAGES;
+static gchar **opt_files = NULL;
+
+static GOptionEntry opt_entries[] = {
+  {"config", 'f', 0, G_OPTION_ARG_FILENAME, &opt_config, "Load experiment configuration from FILE", "FILE"},
+  {"compile", 'c', 0, G_OPTION_ARG_FILENAME, &opt_compile, "Compile program to IMAGE and exit", "IMAGE"},
+  {"diff", 'd', 0, G_OPTION_ARG_STRING, &opt_diff, "Compare configured engine with ENGINE and exit (random soup without FILE)", "ENGINE"},
+  {"diff-cycles", 0, 0, G_OPTION_ARG_INT, &opt_diff_cycles, "Number of cycles to compare engines", "N"},
+  {"diff-interval", 0, 0, G_OPTION_ARG_INT, &opt_diff_interval, "Number of cycles between comparisons", "N"},
+  {"sweep", 0, 0, G_OPTION_ARG_INT, &opt_sweep, "Run N seeds (from --seed) for each combination of rates without TUI and exit", "N"},
+  {"sweep-rates-instr", 0, 0, G_OPTION_ARG_STRING, &opt_sweep_rates_instr, "Instruction mutation rates to sweep", "RATE,..."},
+  {"sweep-rates-mem", 0, 0, G_OPTION_ARG_STRING, &opt_sweep_rates_mem, "Memory mutation rates to sweep", "RATE,..."},
+  {"sweep-rates-kill", 0, 0, G_OPTION_ARG_STRING, &opt_sweep_rates_kill, "Kill mutation rates to sweep", "RATE,..."},
+  {"sweep-cycles", 0, 0, G_OPTION_ARG_INT, &opt_sweep_cycles, "Number of cycles per sweep run", "N"},
+  {"sweep-jobs", 0, 0, G_OPTION_ARG_INT, &opt_sweep_jobs, "Number of sweep runs at a time (0 for number of processors)", "N"},
+  {"bench", 0, 0, G_OPTION_ARG_NONE, &opt_bench, "Run benchmark scenarios of each FILE without TUI and exit", NULL},
+  {"bench-cycles", 0, 0, G_OPTION_ARG_INT, &opt_bench_cycles, "Number of cycles per benchmark scenario", "N"},
+  {"bench-baseline", 0, 0, G_OPTION_ARG_FILENAME, &opt_bench_baseline, "Compare benchmark with baseline FILE (fails if slower or changed)", "FILE"},
+  {"bench-store", 0, 0, G_OPTION_ARG_FILENAME, &opt_bench_store, "Store benchmark results as baseline FILE", "FILE"},
+  {"bench-tolerance", 0, 0, G_OPTION_ARG_DOUBLE, &opt_bench_tolerance, "Max. relative drop of instructions per second compared with baseline", "FRACTION"},
+  {"seed", 's', 0, G_OPTION_ARG_INT64, &opt_seed, "Seed for random number generator (0 for random seed)", "N"},
+  {"page-size", 0, 0, G_OPTION_ARG_INT, &opt_page_size, "Size of memory pages (power of 2)", "N"},
+  {"max-threads", 't', 0, G_OPTION_ARG_INT, &opt_max_threads, "Max. number of threads (0 for unlimited)", "N"},
+  {"reaper", 'r', 0, G_OPTION_ARG_STRING, &opt_reaper, "Reaper policy: none, oldest, random or errors", "POLICY"},
+  {"max-cycles", 0, 0, G_OPTION_ARG_INT, &opt_max_cycles, "Max. number of cycles per thread (0 for unlimited)", "N"},
+  {"scheduler", 0, 0, G_OPTION_ARG_STRING, &opt_scheduler, "Scheduler policy: rr, lottery or budget", "POLICY"},
+  {"quantum", 'q', 0, G_OPTION_ARG_INT, &opt_quantum, "Instructions per quantum", "N"},
+  {"budget", 'b', 0, G_OPTION_ARG_INT, &opt_budget, "Instructions per cycle (lottery and budget scheduler)", "N"},
+  {"engine", 'e', 0, G_OPTION_ARG_STRING, &opt_engine, "Execution engine: interp, trace or native", "ENGINE"},
+  {"population", 'n', 0, G_OPTION_ARG_INT, &opt_population, "Number of initial copies", "N"},
+  {"spread", 0, 0, G_OPTION_ARG_INT64, &opt_spread, "Spread of initial copies around 0", "N"},
+  {"rate-instr", 0, 0, G_OPTION_ARG_DOUBLE, &opt_rate_instr, "Instruction mutation rate", "RATE"},
+  {"rate-mem", 0, 0, G_OPTION_ARG_DOUBLE, &opt_rate_mem, "Memory mutation rate", "RATE"},
+  {"rate-kill", 0, 0, G_OPTION_ARG_DOUBLE, &opt_rate_kill, "Kill mutation rate", "RATE"},
+  {"lineage", 'l', 0, G_OPTION_ARG_INT, &opt_lineage, "Record lineage of threads in up to N records (0 to not record lineage)", "N"},
+  {"lineage-file", 0, 0, G_OPTION_ARG_FILENAME, &opt_lineage_file, "Export lineage to FILE on exit", "FILE"},
+  {"provenance", 'p', 0, G_OPTION_ARG_NONE, &opt_provenance, "Record which thread last wrote each word", NULL},
+  {"evict-interval", 0, 0, G_OPTION_ARG_INT, &opt_evict_interval, "Free clean pages every N cycles (0 for never)", "N"},
+  {"window", 'w', 0, G_OPTION_ARG_INT, &opt_window, "Keep N pages around 0 in reserved address space, read without lookup (0 for no window)", "N"},
+  {"tier-interval", 0, 0, G_OPTION_ARG_INT, &opt_tier_interval, "Sort pages into hot, warm & cold tiers every N cycles (0 for never)", "N"},
+  {"tier-hot", 0, 0, G_OPTION_ARG_INT, &opt_tier_hot, "Keep up to N hot pages in an arena on huge pages", "N"},
+  {"monitor", 'm', 0, G_OPTION_ARG_INT, &opt_monitor, "Stop runs when all threads are dead, or in a plateau or fixation for N cycles (0 to not monitor runs)", "N"},
+  {"monitor-tolerance", 0, 0, G_OPTION_ARG_DOUBLE, &opt_monitor_tolerance, "Max. relative range of the number of threads in a plateau", "FRACTION"},
+  {"monitor-fixation", 0, 0, G_OPTION_ARG_DOUBLE, &opt_monitor_fixation, "Min. fraction of threads with the same genotype for fixation", "FRACTION"},
+  {"monitor-checkpoint", 0, 0, G_OPTION_ARG_FILENAME, &opt_monitor_checkpoint, "Store VM state to FILE when a run is stopped", "FILE"},
+  {"signature", 0, 0, G_OPTION_ARG_STRING, &opt_signature, "Count matches of WORDS in memory overview (slows down)", "WORDS"},
+  {"inspect", 'i', 0, G_OPTION_ARG_FILENAME, &opt_inspect, "Serve VM state on Unix domain socket SOCKET", "SOCKET"},
+  {"inspect-pages", 0, 0, G_OPTION_ARG_INT, &opt_inspect_pages, "Max. number of pages shared with inspecting tools", "N"},
+  {G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &opt_files, NULL, "FILE..."},
+  {NULL}
+};
+
+
+/* Build configuration from defaults, configuration file and command line */
+static gboolean get_conf(rfconf_t *conf, GError **error) {
+  rf_conf_init(conf);
+
+  if (opt_config!=NULL && !rf_conf_load(conf, opt_config, error)) {
+    return FALSE;
+  }
+
+  if (opt_seed>=0) {
+    conf->seed = opt_seed;
+  }
+  if (opt_page_size>=0) {
+    conf->page_size = opt_page_size;
+  }
+  if (opt_max_threads>=0) {
+    conf->max_threads = opt_max_threads;
+  }
+  if (opt_reaper!=NULL) {
+    conf->reaper = rf_reaper_policy_parse(opt_reaper);
+    if (conf->reaper<0) {
+      g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "Unknown reaper policy: %s", opt_reaper);
+      return FALSE;
+    }
+  }
+  if (opt_max_cycles>=0) {
+    conf->max_cycles = opt_max_cycles;
+  }
+  if (opt_scheduler!=NULL) {
+    conf->scheduler = rf_sched_policy_parse(opt_scheduler);
+    if (conf->scheduler<0) {
+      g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "Unknown scheduler policy: %s", opt_scheduler);
+      return FALSE;
+    }
+  }
+  if (opt_quantum>=0) {
+    conf->quantum = opt_quantum;
+  }
+  if (opt_budget>=0) {
+    conf->budget = opt_budget;
+  }
+  if (opt_engine!=NULL) {
+    conf->engine = rf_engine_parse(opt_engine);
+    if (conf->engine<0) {
+      g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "Unknown execution engine: %s", opt_engine);
+      return FALSE;
+    }
+  }
+  if (opt_population>=0) {
+    conf->initial_population = opt_population;
+  }
+  if (opt_spread>=0) {
+    conf->initial_spread = opt_spread;
+  }
+  if (opt_rate_instr>=0.0) {
+    conf->rate_instr = opt_rate_instr;
+  }
+  if (opt_rate_mem>=0.0) {
+    conf->rate_mem = opt_rate_mem;
+  }
+  if (opt_rate_kill>=0.0) {
+    conf->rate_kill = opt_rate_kill;
+  }
+  if (opt_lineage>=0) {
+    conf->lineage = opt_lineage;
+  }
+  if (opt_provenance) {
+    conf->provenance = TRUE;
+  }
+  if (opt_evict_interval>=0) {
+    conf->evict_interval = opt_evict_interval;
+  }
+  if (opt_window>=0) {
+    conf->window = opt_window;
+  }
+  if (opt_tier_interval>=0) {
+    conf->tier_interval = opt_tier_interval;
+  }
+  if (opt_tier_hot>=0) {
+    conf->tier_hot = opt_tier_hot;
+  }
+  if (opt_monitor>=0) {
+    conf->monitor_window = opt_monitor;
+  }
+  if (opt_monitor_tolerance>=0.0) {
+    conf->monitor_tolerance = opt_monitor_tolerance;
+  }
+  if (opt_monitor_fixation>=0.0) {
+    conf->monitor_fixation = opt_monitor_fixation;
+  }
+
+  return TRUE;
+}
 
 
 int main(int argc, char *argv[]) {
   tui_t tui;
   rfvm_t *vm;
-  const char *path;
-  unsigned int length, i;
-  rfp_t p;
+  struct rfinspect *inspect = NULL;
+  struct rfmonitor *monitor = NULL;
+  rfconf_t conf;
+  rfimg_t **images;
+  unsigned int num_images, num_threads, i;
+  int engine;
+  struct rfdiff diff;
+  struct rfsweep sweep;
+  GArray *results, *baseline;
+  unsigned int num_regressions;
+  GOptionContext *context;
+  GError *error = NULL;
+
+  /* parse command line */
+  context = g_option_context_new("- self-replicating brainfuck programs");
+  g_option_context_add_main_entries(context, opt_entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    fprintf(stderr, "%s: %s\n", argv[0], error->message);
+    return 1;
+  }
+  g_option_context_free(context);
 
-  /* get program path */
-  if (argc>=2) {
-    path = argv[1];
+  /* get program paths (not needed to compare engines in random soup) */
+  if ((opt_files==NULL || opt_files[0]==NULL) && opt_diff==NULL) {
+    printf("Usage: %s [OPTION...] FILE...\n", argv[0]);
+    return 1;
   }
-  else {
-    printf("Usage: %s FILE\n", argv[0]);
+
+  /* compile program image */
+  if (opt_compile!=NULL) {
+    images = g_new(rfimg_t*, 1);
+    images[0] = rf_image_compile(opt_files[0]);
+    if (images[0]==NULL || !rf_image_store(images[0], opt_compile)) {
+      fprintf(stderr, "%s: can't compile %s to %s\n", argv[0], opt_files[0], opt_compile);
+      return 1;
+    }
+    printf("%s: %lu words\n", opt_compile, images[0]->length);
+    rf_image_free(images[0]);
+    g_free(images);
+    return 0;
+  }
+
+  /* get configuration */
+  if (!get_conf(&conf, &error)) {
+    fprintf(stderr, "%s: %s\n", argv[0], error->message);
     return 1;
   }
 
+  /* load programs (source files or images) */
+  num_images = opt_files!=NULL ? g_strv_length(opt_files) : 0;
+  images = g_new(rfimg_t*, num_images);
+  for (i=0; i<num_images; i++) {
+    images[i] = rf_image_load(opt_files[i]);
+    if (images[i]==NULL) {
+      fprintf(stderr, "%s: can't load %s\n", argv[0], opt_files[i]);
+      return 1;
+    }
+    printf("%s: %lu words\n", opt_files[i], images[i]->length);
+  }
+
+  /* compare engines */
+  if (opt_diff!=NULL) {
+    engine = rf_engine_parse(opt_diff);
+    if (engine<0) {
+      fprintf(stderr, "%s: Unknown execution engine: %s\n", argv[0], opt_diff);
+      return 1;
+    }
+    if (conf.seed==0) {
+      conf.seed = (unsigned long)g_random_int();
+    }
+
+    if (rf_diff_run(&conf, conf.engine, engine, images, num_images, opt_diff_cycles, opt_diff_interval, &diff)) {
+      printf("%s and %s agree after %u cycles (seed %lu)\n", rf_engine_name(conf.engine), opt_diff, diff.clock, conf.seed);
+    }
+    else {
+      printf("%s and %s diverge at clock %u (seed %lu): %s\n", rf_engine_name(conf.engine), opt_diff, diff.clock, conf.seed, diff.reason);
+    }
+
+    for (i=0; i<num_images; i++) {
+      rf_image_free(images[i]);
+    }
+    g_free(images);
+    return diff.diverged ? 1 : 0;
+  }
+
+  /* parameter sweep */
+  if (opt_sweep>0) {
+    sweep.seed = conf.seed!=0 ? conf.seed : 1;
+    sweep.num_seeds = opt_sweep;
+    sweep.rates_instr = g_array_new(FALSE, FALSE, sizeof(double));
+    sweep.rates_mem = g_array_new(FALSE, FALSE, sizeof(double));
+    sweep.rates_kill = g_array_new(FALSE, FALSE, sizeof(double));
+    sweep.cycles = opt_sweep_cycles;
+    sweep.jobs = opt_sweep_jobs;
+
+    if ((opt_sweep_rates_instr!=NULL && !rf_sweep_parse_rates(sweep.rates_instr, opt_sweep_rates_instr))
+        || (opt_sweep_rates_mem!=NULL && !rf_sweep_parse_rates(sweep.rates_mem, opt_sweep_rates_mem))
+        || (opt_sweep_rates_kill!=NULL && !rf_sweep_parse_rates(sweep.rates_kill, opt_sweep_rates_kill))) {
+      fprintf(stderr, "%s: invalid list of rates\n", argv[0]);
+      return 1;
+    }
+
+    results = rf_sweep_run(&conf, &sweep, images, num_images);
+    rf_sweep_print(results, stdout);
+
+    g_array_free(results, TRUE);
+    g_array_free(sweep.rates_instr, TRUE);
+    g_array_free(sweep.rates_mem, TRUE);
+    g_array_free(sweep.rates_kill, TRUE);
+    for (i=0; i<num_images; i++) {
+      rf_image_free(images[i]);
+    }
+    g_free(images);
+    return 0;
+  }
+
+  /* benchmark scenarios */
+  if (opt_bench) {
+    if (opt_bench_baseline!=NULL) {
+      baseline = rf_bench_load(opt_bench_baseline);
+      if (baseline==NULL) {
+        fprintf(stderr, "%s: can't load baseline %s\n", argv[0], opt_bench_baseline);
+        return 1;
+      }
+    }
+    else {
+      baseline = g_array_new(FALSE, FALSE, sizeof(struct rfbench_result));
+    }
+
+    results = rf_bench_run(&conf, opt_bench_cycles, images, opt_files, num_images);
+    num_regressions = rf_bench_compare(results, baseline, opt_bench_tolerance);
+    rf_bench_print(results, stdout);
+
+    if (opt_bench_store!=NULL && !rf_bench_store(results, opt_bench_store)) {
+      fprintf(stderr, "%s: can't store baseline %s\n", argv[0], opt_bench_store);
+      num_regressions++;
+    }
+
+    g_array_free(results, TRUE);
+    g_array_free(baseline, TRUE);
+    for (i=0; i<num_images; i++) {
+      rf_image_free(images[i]);
+    }
+    g_free(images);
+    return num_regressions>0 ? 1 : 0;
+  }
+
   /* brainfuck */
-  vm = rf_vm_new();
+  vm = rf_vm_new_full(&conf);
+  if (vm==NULL) {
+    fprintf(stderr, "%s: invalid page size (%u), quantum (%u) or budget (%u)\n", argv[0], conf.page_size, conf.quantum, conf.budget);
+    return 1;
+  }
+  num_threads = rf_seed_population(vm, images, num_images, conf.initial_population, 0, conf.initial_spread);
+  printf("%u threads seeded (seed %lu)\n", num_threads, vm->conf.seed);
+
+  if (opt_signature!=NULL) {
+    rf_vm_set_signature(vm, opt_signature, strlen(opt_signature));
+  }
 
-  for (i=0; i<INITIAL_POPULATION_SIZE; i++) {
-    p = rf_rand_p(vm, 0, 2*RFMEM_PAGE_SIZE);
-    length = rf_load_program(vm, path, p);
-    rf_thread_add_full(vm, p, p, p, NULL, 0);
-    printf("%s: at %ld, %u words\n", path, p, length);
+  for (i=0; i<num_images; i++) {
+    rf_image_free(images[i]);
+  }
+  g_free(images);
+
+  /* inspection server */
+  if (opt_inspect!=NULL) {
+    inspect = rf_inspect_new(vm, opt_inspect, opt_inspect_pages, &error);
+    if (inspect==NULL) {
+      fprintf(stderr, "%s: %s\n", argv[0], error->message);
+      return 1;
+    }
+  }
+
+  /* run monitor */
+  if (conf.monitor_window>0) {
+    monitor = rf_monitor_new(vm);
   }
 
   /* TUI */
   tui_init(&tui, vm);
+  tui.inspect = inspect;
+  tui.monitor = monitor;
+  tui.checkpoint = opt_monitor_checkpoint;
   tui_main(&tui);
 
   /* shutdown */
+  if (opt_lineage_file!=NULL && vm->lineage!=NULL && !rf_lineage_export(vm->lineage, opt_lineage_file)) {
+    fprintf(stderr, "%s: can't export lineage to %s\n", argv[0], opt_lineage_file);
+  }
+  if (inspect!=NULL) {
+    rf_inspect_free(inspect);
+  }
+  if (monitor!=NULL) {
+    rf_monitor_free(monitor);
+  }
   rf_vm_free(vm);
   tui_finalize(&tui);
 
   return 0;
 }
-
-
@@ -0,0 +1,157 @@
+/* monitor.c - detection of extinction & steady states
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+
+#include "replifuck.h"
+#include "monitor.h"
+
+
+static const char *rf_monitor_state_names[] = {
+  "running",
+  "extinct",
+  "plateau",
+  "fixation",
+  NULL
+};
+
+
+/* Get name of run state */
+const char *rf_monitor_state_name(int state) {
+  if (state>=0 && state<RFMONITOR_NUM_STATES) {
+    return rf_monitor_state_names[state];
+  }
+  else {
+    return NULL;
+  }
+}
+
+
+/* Create monitor for run of VM, as configured for the VM. The configured
+ * window mustn't be 0, since the VM records genotypes only then.
+ */
+struct rfmonitor *rf_monitor_new(rfvm_t *vm) {
+  struct rfmonitor *monitor;
+
+  monitor = g_new0(struct rfmonitor, 1);
+  monitor->window = vm->conf.monitor_window;
+  monitor->tolerance = vm->conf.monitor_tolerance;
+  monitor->fixation = vm->conf.monitor_fixation;
+  monitor->state = RFMONITOR_RUNNING;
+
+  monitor->population.start = vm->clock;
+  monitor->population.min = monitor->population.max = rf_get_num_threads(vm);
+
+  monitor->genotypes.next_census = vm->clock;
+  monitor->genotypes.census = g_hash_table_new(NULL, NULL);
+
+  return monitor;
+}
+
+
+void rf_monitor_free(struct rfmonitor *monitor) {
+  g_hash_table_destroy(monitor->genotypes.census);
+  g_free(monitor);
+}
+
+
+/* Count threads by genotype, restart fixation if the dominant genotype
+ * changed or isn't frequent enough
+ */
+static void rf_monitor_census(struct rfmonitor *monitor, rfvm_t *vm) {
+  GHashTable *census = monitor->genotypes.census;
+  rfth_t *thread;
+  guint32 dominant = 0;
+  unsigned int i, n = 0, count, max = 0;
+
+  g_hash_table_remove_all(census);
+  for (i=0; i<vm->threads->len; i++) {
+    thread = g_ptr_array_index(vm->threads, i);
+    if (thread->dead) {
+      continue;
+    }
+
+    count = GPOINTER_TO_UINT(g_hash_table_lookup(census, GUINT_TO_POINTER(thread->genotype)))+1;
+    g_hash_table_insert(census, GUINT_TO_POINTER(thread->genotype), GUINT_TO_POINTER(count));
+    if (count>max) {
+      max = count;
+      dominant = thread->genotype;
+    }
+    n++;
+  }
+
+  if (n>0 && max>=monitor->fixation*n) {
+    if (!monitor->genotypes.fixating || dominant!=monitor->genotypes.dominant) {
+      monitor->genotypes.fixating = TRUE;
+      monitor->genotypes.start = vm->clock;
+      monitor->genotypes.dominant = dominant;
+    }
+  }
+  else {
+    monitor->genotypes.fixating = FALSE;
+  }
+}
+
+
+/* Update monitor after a cycle. Returns TRUE, if a state was detected by
+ * this update
+ */
+gboolean rf_monitor_update(struct rfmonitor *monitor, rfvm_t *vm) {
+  unsigned int n;
+
+  if (monitor->state!=RFMONITOR_RUNNING) {
+    return FALSE;
+  }
+
+  n = rf_get_num_threads(vm);
+  if (n==0) {
+    monitor->state = RFMONITOR_EXTINCT;
+  }
+  else {
+    /* restart window, if the population left the range */
+    monitor->population.min = MIN(monitor->population.min, n);
+    monitor->population.max = MAX(monitor->population.max, n);
+    if (monitor->population.max-monitor->population.min>monitor->tolerance*monitor->population.max) {
+      monitor->population.start = vm->clock;
+      monitor->population.min = monitor->population.max = n;
+    }
+
+    if (vm->clock>=monitor->genotypes.next_census) {
+      rf_monitor_census(monitor, vm);
+      monitor->genotypes.next_census = vm->clock+MAX(monitor->window/RFMONITOR_CENSUSES, 1);
+    }
+
+    if (monitor->genotypes.fixating && vm->clock-monitor->genotypes.start>=monitor->window) {
+      monitor->state = RFMONITOR_FIXATION;
+    }
+    else if (vm->clock-monitor->population.start>=monitor->window) {
+      monitor->state = RFMONITOR_PLATEAU;
+    }
+  }
+
+  if (monitor->state!=RFMONITOR_RUNNING) {
+    monitor->clock = vm->clock;
+    return TRUE;
+  }
+
+  return FALSE;
+}
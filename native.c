@@ -0,0 +1,388 @@
+/* native.c - native code for traces
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "replifuck.h"
+#include "page.h"
+#include "trace.h"
+#include "native.h"
+
+
+
+/* Max. number of iterations, for which words a to b, moving by d per
+ * iteration, stay within lo to hi
+ */
+static guint64 rf_native_within(rfp_t a, rfp_t b, int d, rfp_t lo, rfp_t hi) {
+  if (a<lo || b>hi) {
+    return 0;
+  }
+  else if (d>0) {
+    return (hi-b)/d+1;
+  }
+  else if (d<0) {
+    return (a-lo)/(-d)+1;
+  }
+  else {
+    return G_MAXUINT64;
+  }
+}
+
+
+/* Max. number of iterations, for which words a to b, moving by d per
+ * iteration, stay outside of lo to hi
+ */
+static guint64 rf_native_disjoint(rfp_t a, rfp_t b, int d, rfp_t lo, rfp_t hi) {
+  if (b<lo) {
+    return d>0 ? (lo-1-b)/d+1 : G_MAXUINT64;
+  }
+  else if (a>hi) {
+    return d<0 ? (a-hi-1)/(-d)+1 : G_MAXUINT64;
+  }
+  else {
+    return 0;
+  }
+}
+
+
+#if defined(__x86_64__)
+
+/* Max. size of machine code */
+#define RFNATIVE_MAX_CODE (32+16*RFTRACE_MAX_OPS)
+
+static void rf_native_emit(guint8 *code, size_t *len, const char *bytes, size_t n) {
+  memcpy(code+*len, bytes, n);
+  *len += n;
+}
+
+static void rf_native_emit32(guint8 *code, size_t *len, gint32 x) {
+  guint32 u = (guint32)x;
+
+  code[(*len)++] = u&0xFF;
+  code[(*len)++] = (u>>8)&0xFF;
+  code[(*len)++] = (u>>16)&0xFF;
+  code[(*len)++] = (u>>24)&0xFF;
+}
+
+
+/* Generate machine code (System V ABI: DP in rdi, SP in rsi, n in edx)
+ *
+ *         xor  eax, eax
+ *   loop: cmp  eax, edx
+ *         jae  done
+ *         ...  operations
+ *         add  rdi, shift
+ *         inc  eax
+ *         cmp  byte [rdi], 0
+ *         jne  loop
+ *   done: ret
+ */
+static size_t rf_native_generate(struct rftrace *trace, guint8 *code) {
+  size_t len = 0, loop, jae, done;
+  unsigned int i;
+  struct rftrace_op *op;
+
+  rf_native_emit(code, &len, "\x31\xC0", 2);
+  loop = len;
+  rf_native_emit(code, &len, "\x39\xD0\x0F\x83", 4);
+  jae = len;
+  rf_native_emit32(code, &len, 0);
+
+  for (i=0; i<trace->num_ops; i++) {
+    op = &trace->ops[i];
+    switch (op->opcode) {
+      case RFTRACE_ADD:
+        /* add byte [rdi+off], delta */
+        rf_native_emit(code, &len, "\x80\x87", 2);
+        rf_native_emit32(code, &len, op->off);
+        code[len++] = op->delta&0xFF;
+        break;
+
+      case RFTRACE_PUSH:
+        /* dec rsi; mov cl, [rdi+off]; mov [rsi], cl */
+        rf_native_emit(code, &len, "\x48\xFF\xCE\x8A\x8F", 5);
+        rf_native_emit32(code, &len, op->off);
+        rf_native_emit(code, &len, "\x88\x0E", 2);
+        break;
+
+      case RFTRACE_POP:
+        /* mov cl, [rsi]; mov [rdi+off], cl; inc rsi */
+        rf_native_emit(code, &len, "\x8A\x0E\x88\x8F", 4);
+        rf_native_emit32(code, &len, op->off);
+        rf_native_emit(code, &len, "\x48\xFF\xC6", 3);
+        break;
+    }
+  }
+
+  if (trace->shift!=0) {
+    rf_native_emit(code, &len, "\x48\x81\xC7", 3);
+    rf_native_emit32(code, &len, trace->shift);
+  }
+
+  rf_native_emit(code, &len, "\xFF\xC0\x80\x3F\x00\x0F\x85", 7);
+  rf_native_emit32(code, &len, (gint32)loop-(gint32)(len+4));
+
+  /* patch jump to end */
+  done = len;
+  rf_native_emit(code, &len, "\xC3", 1);
+  rf_native_emit32(code, &jae, (gint32)done-(gint32)(jae+4));
+
+  return len;
+}
+
+#endif
+
+
+/* Compile trace to native code. Returns NULL, if that isn't possible */
+struct rfnative *rf_native_compile(struct rftrace *trace) {
+  struct rfnative *native;
+  unsigned int i;
+  int sp = 0;
+  struct rftrace_op *op;
+#if defined(__x86_64__)
+  guint8 code[RFNATIVE_MAX_CODE];
+  size_t len, page_size;
+  void *mem;
+#endif
+
+  native = g_new0(struct rfnative, 1);
+
+  /* accessed offsets */
+  native->dp_min = MIN(0, trace->shift);
+  native->dp_max = MAX(0, trace->shift);
+  for (i=0; i<trace->num_ops; i++) {
+    op = &trace->ops[i];
+    native->dp_min = MIN(native->dp_min, op->off);
+    native->dp_max = MAX(native->dp_max, op->off);
+
+    if (op->opcode==RFTRACE_PUSH) {
+      sp--;
+      if (!native->uses_sp || sp<native->sp_wmin) {
+        native->sp_wmin = sp;
+      }
+      if (!native->uses_sp || sp>native->sp_wmax) {
+        native->sp_wmax = sp;
+      }
+    }
+    if (op->opcode==RFTRACE_PUSH || op->opcode==RFTRACE_POP) {
+      if (!native->uses_sp || sp<native->sp_min) {
+        native->sp_min = sp;
+      }
+      if (!native->uses_sp || sp>native->sp_max) {
+        native->sp_max = sp;
+      }
+      native->uses_sp = TRUE;
+    }
+    if (op->opcode==RFTRACE_POP) {
+      sp++;
+    }
+    if (op->opcode==RFTRACE_ADD || op->opcode==RFTRACE_POP) {
+      native->dp_writes++;
+    }
+  }
+  native->sp_shift = sp;
+
+#if defined(__x86_64__)
+  len = rf_native_generate(trace, code);
+
+  /* map writable, copy code & make it executable */
+  page_size = (size_t)sysconf(_SC_PAGESIZE);
+  native->size = (len+page_size-1)&~(page_size-1);
+  mem = mmap(NULL, native->size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (mem==MAP_FAILED) {
+    g_free(native);
+    return NULL;
+  }
+  memcpy(mem, code, len);
+  if (mprotect(mem, native->size, PROT_READ|PROT_EXEC)!=0) {
+    munmap(mem, native->size);
+    g_free(native);
+    return NULL;
+  }
+
+  native->code = mem;
+  native->func = (rfnative_func_t)mem;
+
+  return native;
+#else
+  g_free(native);
+  return NULL;
+#endif
+}
+
+
+/* Free native code */
+void rf_native_free(struct rfnative *native) {
+#if defined(__x86_64__)
+  munmap(native->code, native->size);
+#endif
+  g_free(native);
+}
+
+
+/* Run loop at IP natively, as long as it stays on the pages of DP & SP.
+ * Returns number of executed instructions (0 if the trace must be run) and
+ * if the loop was left.
+ */
+unsigned int rf_native_run(rfvm_t *vm, struct rftrace *trace, rfth_t *thread, unsigned int limit, gboolean *exited) {
+  struct rfnative *native = trace->native;
+  int pid, sp_pid;
+  unsigned int off, sp_off = 0, n;
+  guint64 k;
+  rfp_t lo, sp_lo, dp_first, dp_last, sp_first = 0, sp_last = 0, sum_first, sum_last;
+  gboolean write_sp = FALSE, sum_sp;
+  rfpage_t *page, *sp_page = NULL;
+
+  k = limit/trace->cost;
+
+  /* accesses to DP stay on its page, writes outside of the loop */
+  rf_memory_get_pid_and_offset(thread->dp, vm->page_shift, &pid, &off);
+  lo = thread->dp-off;
+  k = MIN(k, rf_native_within(thread->dp+native->dp_min, thread->dp+native->dp_max, trace->shift, lo, lo+vm->page_size-1));
+  if (trace->writes_dp) {
+    k = MIN(k, rf_native_disjoint(thread->dp+trace->min_off, thread->dp+trace->max_off, trace->shift, trace->start, trace->end));
+  }
+
+  /* accesses to SP stay on its page (which must exist), pushes outside of
+   * the loop
+   */
+  if (k>0 && native->uses_sp) {
+    rf_memory_get_pid_and_offset(thread->sp, vm->page_shift, &sp_pid, &sp_off);
+    sp_page = rf_memory_peek_page(vm, sp_pid, &thread->tlb);
+    if (sp_page==NULL) {
+      return 0;
+    }
+    lo = thread->sp-sp_off;
+    k = MIN(k, rf_native_within(thread->sp+native->sp_min, thread->sp+native->sp_max, native->sp_shift, lo, lo+vm->page_size-1));
+    if (trace->pushes>0) {
+      k = MIN(k, rf_native_disjoint(thread->sp+native->sp_wmin, thread->sp+native->sp_wmax, native->sp_shift, trace->start, trace->end));
+    }
+  }
+
+  if (k==0) {
+    return 0;
+  }
+
+  /* native code doesn't copy shared pages, so do it before (pushes to DP's
+   * page must go to the same copy it's read from)
+   */
+  if (trace->writes_dp || (sp_page!=NULL && sp_pid==pid && trace->pushes>0)) {
+    page = rf_memory_lookup_page_for_write(vm, pid, &thread->tlb);
+  }
+  else {
+    page = rf_memory_lookup_page(vm, pid, &thread->tlb);
+  }
+  if (sp_page!=NULL && sp_pid==pid) {
+    sp_page = page;
+  }
+  else if (sp_page!=NULL) {
+    sp_page = rf_memory_peek_page(vm, sp_pid, &thread->tlb);
+    if (trace->pushes>0 && g_atomic_int_get(&sp_page->refs)>1) {
+      sp_page = rf_memory_unshare_page(vm, sp_pid, sp_page);
+    }
+  }
+
+  /* words that may be written */
+  dp_first = thread->dp+trace->min_off+MIN(0, (rfp_t)(k-1)*trace->shift);
+  dp_last = thread->dp+trace->max_off+MAX(0, (rfp_t)(k-1)*trace->shift);
+  if (sp_page!=NULL && trace->pushes>0) {
+    sp_first = thread->sp+native->sp_wmin+MIN(0, (rfp_t)(k-1)*native->sp_shift);
+    sp_last = thread->sp+native->sp_wmax+MAX(0, (rfp_t)(k-1)*native->sp_shift);
+    write_sp = TRUE;
+  }
+
+  /* the running trace mustn't be dropped (checked above, but it would be
+   * freed while it's run)
+   */
+  if ((trace->writes_dp && dp_first<=trace->end && dp_last>=trace->start)
+      || (write_sp && sp_first<=trace->end && sp_last>=trace->start)) {
+    return 0;
+  }
+
+  /* words on the same page are counted in the summary only once (the span
+   * between both ranges isn't written, so counting it again doesn't change
+   * the summary)
+   */
+  sum_first = dp_first;
+  sum_last = dp_last;
+  sum_sp = write_sp;
+  if (write_sp && sp_page==page && trace->writes_dp) {
+    sum_first = MIN(dp_first, sp_first);
+    sum_last = MAX(dp_last, sp_last);
+    sum_sp = FALSE;
+  }
+
+  if (trace->writes_dp) {
+    page->dirty = TRUE;
+  }
+  if (write_sp) {
+    sp_page->dirty = TRUE;
+  }
+
+  /* native code doesn't check for traces, so drop those that may be written
+   * (each range on its own, the loop's code may lie between them)
+   */
+  if (page->traces!=NULL && trace->writes_dp) {
+    rf_trace_invalidate(vm, page, dp_first, dp_last);
+  }
+  if (write_sp && sp_page->traces!=NULL) {
+    rf_trace_invalidate(vm, sp_page, sp_first, sp_last);
+  }
+
+  /* native code doesn't update page summaries either, so count them again */
+  lo = thread->dp-off;
+  sp_lo = thread->sp-sp_off;
+  if (trace->writes_dp) {
+    rf_page_summary_update(vm, page, sum_first-lo, sum_last-lo, -1);
+  }
+  if (sum_sp) {
+    rf_page_summary_update(vm, sp_page, sp_first-sp_lo, sp_last-sp_lo, -1);
+  }
+
+  n = native->func(page->data+off, sp_page!=NULL ? sp_page->data+sp_off : NULL, (unsigned int)k);
+
+  if (trace->writes_dp) {
+    rf_page_summary_update(vm, page, sum_first-lo, sum_last-lo, 1);
+    page->summary.num_writes += n*native->dp_writes;
+  }
+  if (sum_sp) {
+    rf_page_summary_update(vm, sp_page, sp_first-sp_lo, sp_last-sp_lo, 1);
+  }
+  if (write_sp) {
+    sp_page->summary.num_writes += n*trace->pushes;
+  }
+  /* all pushes & pops stayed on SP's and DP's pages */
+  if (sp_page==page) {
+    vm->stack.shared += n*(trace->pushes+trace->pops);
+  }
+
+  thread->dp += (rfp_t)n*trace->shift;
+  thread->sp += (rfp_t)n*native->sp_shift;
+  *exited = page->data[off+(rfp_t)n*trace->shift]==0;
+
+  return n*trace->cost;
+}
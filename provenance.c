@@ -0,0 +1,121 @@
+/* provenance.c - writers of memory words
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "replifuck.h"
+#include "provenance.h"
+
+
+/* List writers of a page, all words have the page's writer */
+void rf_provenance_expand(rfvm_t *vm, rfpage_t *page) {
+  struct rfpage_shadow *shadow = &page->shadow;
+  unsigned int i;
+
+  shadow->writers = g_new(guint32, vm->page_size);
+  for (i=0; i<vm->page_size; i++) {
+    shadow->writers[i] = shadow->writer;
+  }
+  shadow->num_foreign = 0;
+}
+
+
+/* Count foreign words again, relative to the writer of word off. If all words
+ * have the same writer, the list is freed.
+ */
+void rf_provenance_compress(rfvm_t *vm, rfpage_t *page, unsigned int off) {
+  struct rfpage_shadow *shadow = &page->shadow;
+  unsigned int i;
+
+  if (shadow->num_foreign>0) {
+    shadow->writer = shadow->writers[off];
+    shadow->num_foreign = 0;
+    for (i=0; i<vm->page_size; i++) {
+      shadow->num_foreign += shadow->writers[i]!=shadow->writer;
+    }
+  }
+
+  if (shadow->num_foreign==0) {
+    g_free(shadow->writers);
+    shadow->writers = NULL;
+  }
+}
+
+
+/* Record writer of words first to last of a page */
+void rf_provenance_write_range(rfvm_t *vm, rfpage_t *page, unsigned int first, unsigned int last, guint32 writer) {
+  struct rfpage_shadow *shadow = &page->shadow;
+  unsigned int i;
+
+  if (first==0 && last==vm->page_size-1) {
+    rf_provenance_free(page);
+    shadow->writer = writer;
+    shadow->num_foreign = 0;
+  }
+  else {
+    for (i=first; i<=last; i++) {
+      rf_provenance_write(vm, page, i, writer);
+    }
+  }
+}
+
+
+/* Copy writers of a page to its copy */
+void rf_provenance_copy(rfvm_t *vm, rfpage_t *copy, rfpage_t *page) {
+  copy->shadow = page->shadow;
+  if (page->shadow.writers!=NULL) {
+    copy->shadow.writers = g_memdup(page->shadow.writers, sizeof(guint32)*vm->page_size);
+  }
+}
+
+
+/* Free writers of a page */
+void rf_provenance_free(rfpage_t *page) {
+  g_free(page->shadow.writers);
+  page->shadow.writers = NULL;
+}
+
+
+/* Get writer of each word of a page (page size entries). Returns FALSE, if
+ * the page doesn't exist.
+ */
+gboolean rf_provenance_get(rfvm_t *vm, int pid, guint32 *writers) {
+  rfpage_t *page;
+  unsigned int i;
+
+  page = g_tree_lookup(vm->memory, GINT_TO_POINTER(pid));
+  if (page==NULL) {
+    return FALSE;
+  }
+
+  if (page->shadow.writers!=NULL) {
+    memcpy(writers, page->shadow.writers, sizeof(guint32)*vm->page_size);
+  }
+  else {
+    for (i=0; i<vm->page_size; i++) {
+      writers[i] = page->shadow.writer;
+    }
+  }
+
+  return TRUE;
+}
@@ -0,0 +1,177 @@
+/* reaper.c - population control for replifuck
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * The reaper queue is a doubly linked list of all living threads. New threads
+ * are appended at the bottom, the thread at the top is the next victim. Since
+ * all threads are run at the same rate, the queue is ordered by thread clock,
+ * so the top is the oldest thread. With the Tierra-style policy a thread moves
+ * up one position for each error it makes and down one position for each
+ * successful fork.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <gsl/gsl_rng.h>
+
+#include "replifuck.h"
+#include "reaper.h"
+
+
+static const char *rf_reaper_policy_names[] = {
+  "none",
+  "oldest",
+  "random",
+  "errors",
+  NULL
+};
+
+
+/* Get reaper policy by name. Returns -1 for unknown names */
+int rf_reaper_policy_parse(const char *name) {
+  int i;
+
+  for (i=0; rf_reaper_policy_names[i]!=NULL; i++) {
+    if (strcmp(rf_reaper_policy_names[i], name)==0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+
+/* Get name of reaper policy */
+const char *rf_reaper_policy_name(int policy) {
+  if (policy>=0 && policy<RFREAP_NUM_POLICIES) {
+    return rf_reaper_policy_names[policy];
+  }
+  else {
+    return NULL;
+  }
+}
+
+
+/* Append thread at the bottom of the reaper queue */
+void rf_reaper_push(rfvm_t *vm, rfth_t *thread) {
+  thread->reap_prev = vm->reaper.bottom;
+  thread->reap_next = NULL;
+
+  if (vm->reaper.bottom!=NULL) {
+    vm->reaper.bottom->reap_next = thread;
+  }
+  else {
+    vm->reaper.top = thread;
+  }
+  vm->reaper.bottom = thread;
+}
+
+
+/* Remove thread from the reaper queue */
+void rf_reaper_unlink(rfvm_t *vm, rfth_t *thread) {
+  if (thread->reap_prev!=NULL) {
+    thread->reap_prev->reap_next = thread->reap_next;
+  }
+  else {
+    vm->reaper.top = thread->reap_next;
+  }
+
+  if (thread->reap_next!=NULL) {
+    thread->reap_next->reap_prev = thread->reap_prev;
+  }
+  else {
+    vm->reaper.bottom = thread->reap_prev;
+  }
+
+  thread->reap_prev = NULL;
+  thread->reap_next = NULL;
+}
+
+
+/* Swap thread with its successor in the reaper queue */
+static void rf_reaper_swap_next(rfvm_t *vm, rfth_t *a) {
+  rfth_t *b = a->reap_next;
+
+  if (b==NULL) {
+    return;
+  }
+
+  /* relink neighbours */
+  if (a->reap_prev!=NULL) {
+    a->reap_prev->reap_next = b;
+  }
+  else {
+    vm->reaper.top = b;
+  }
+  if (b->reap_next!=NULL) {
+    b->reap_next->reap_prev = a;
+  }
+  else {
+    vm->reaper.bottom = a;
+  }
+
+  /* swap a & b */
+  b->reap_prev = a->reap_prev;
+  a->reap_next = b->reap_next;
+  a->reap_prev = b;
+  b->reap_next = a;
+}
+
+
+/* Thread made an error: move it up one position */
+void rf_reaper_error(rfvm_t *vm, rfth_t *thread) {
+  thread->errors++;
+
+  if (vm->conf.reaper==RFREAP_ERRORS && thread->reap_prev!=NULL) {
+    rf_reaper_swap_next(vm, thread->reap_prev);
+  }
+}
+
+
+/* Thread forked successfully: move it down one position */
+void rf_reaper_reward(rfvm_t *vm, rfth_t *thread) {
+  if (vm->conf.reaper==RFREAP_ERRORS) {
+    rf_reaper_swap_next(vm, thread);
+  }
+}
+
+
+/* Select next victim. Returns NULL, if the policy doesn't reap */
+rfth_t *rf_reaper_select(rfvm_t *vm) {
+  rfth_t *thread;
+
+  switch (vm->conf.reaper) {
+    case RFREAP_OLDEST:
+    case RFREAP_ERRORS:
+      return vm->reaper.top;
+
+    case RFREAP_RANDOM:
+      /* dead threads are only left until the end of the cycle, so this
+       * terminates quickly
+       */
+      do {
+        thread = g_ptr_array_index(vm->threads, gsl_rng_uniform_int(vm->rand, vm->threads->len));
+      } while (thread->dead);
+      return thread;
+
+    default:
+      return NULL;
+  }
+}
@@ -22,11 +22,23 @@
 
 #include <glib.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <gsl/gsl_rng.h>
 #include <gsl/gsl_randist.h>
 
 #include "replifuck.h"
+#include "reaper.h"
+#include "page.h"
+#include "trace.h"
+#include "stack.h"
+#include "inspect.h"
+#include "lineage.h"
+#include "provenance.h"
+#include "events.h"
+#include "window.h"
+#include "tier.h"
 
 
 
@@ -40,7 +52,7 @@ static int rf_memory_pid_compare(const void *a, const void *b, void *userdata) {
 struct bt_memory_get_page_indexed_iterargs {
   unsigned int idx;
   int pid;
-  rfword_t *page;
+  rfpage_t *page;
 };
 static gboolean bt_memory_get_page_indexed_iter(void *key, void *value, void *userdata) {
   struct bt_memory_get_page_indexed_iterargs *args = (struct bt_memory_get_page_indexed_iterargs*)userdata;
@@ -52,7 +64,7 @@ static gboolean bt_memory_get_page_indexed_iter(void *key, void *value, void *us
   }
   else {
     args->pid = GPOINTER_TO_INT(key);
-    args->page = (rfword_t*)value;
+    args->page = (rfpage_t*)value;
 
     return TRUE;
   }
@@ -77,9 +89,59 @@ static void rf_rand(rfvm_t *vm, void *data, unsigned int n) {
 }
 
 
-/* Returns TRUE if an mutation occurs */
-static gboolean rf_rand_mutation(rfvm_t *vm, double rate) {
-  return gsl_ran_binomial(vm->rand, rate, 1);
+/* SplitMix64 finalizer */
+static inline guint64 rf_rand_mix64(guint64 x) {
+  x = (x^(x>>30))*0xBF58476D1CE4E5B9ULL;
+  x = (x^(x>>27))*0x94D049BB133111EBULL;
+  return x^(x>>31);
+}
+
+
+/* Fill page with random words. They only depend on the seed and the page
+ * ID, so pages get the same content regardless of the order they're touched
+ * in, and clean pages can be freed and created again. Each 64 bit chunk is
+ * hashed from its own counter, so the loop has no dependencies and can be
+ * vectorised.
+ * NOTE: This doesn't use the VM's random number generator and is
+ *       async-signal-safe (it's called by the fault handler of the memory
+ *       window).
+ */
+void rf_rand_page_words(unsigned long seed, int pid, rfword_t *data, unsigned int page_size) {
+  guint64 key, tail, *data64 = (guint64*)data;
+  unsigned int i, n = sizeof(rfword_t)*page_size;
+
+  key = rf_rand_mix64(rf_rand_mix64(seed)+(guint32)pid);
+
+  for (i=0; i<n/8; i++) {
+    data64[i] = rf_rand_mix64(key+(i+1)*0x9E3779B97F4A7C15ULL);
+  }
+
+  if (n%8!=0) {
+    tail = rf_rand_mix64(key+(i+1)*0x9E3779B97F4A7C15ULL);
+    memcpy((guint8*)data+n-n%8, &tail, n%8);
+  }
+}
+
+static void rf_rand_page(rfvm_t *vm, rfpage_t *page, int pid) {
+  rf_rand_page_words(vm->conf.seed, pid, page->data, vm->page_size);
+}
+
+
+/* Returns number of instructions until the next mutation (geometric
+ * distribution, so that mutations don't need to be drawn for every instruction)
+ */
+static guint64 rf_rand_mutation(rfvm_t *vm, double rate) {
+  double n;
+
+  if (rate<=0.0) {
+    return G_MAXUINT64;
+  }
+  else if (rate>=1.0) {
+    return 1;
+  }
+
+  n = ceil(log(gsl_rng_uniform_pos(vm->rand))/log1p(-rate));
+  return n<1.0 ? 1 : (n>=(double)G_MAXUINT64 ? G_MAXUINT64 : (guint64)n);
 }
 
 
@@ -89,12 +151,262 @@ rfp_t rf_rand_p(rfvm_t *vm, rfp_t mu, rfsz_t sigma) {
 }
 
 
+/* Words that are instructions */
+const guint8 rf_opcodes[256] = {
+  ['>'] = 1, ['<'] = 1, ['+'] = 1, ['-'] = 1, [','] = 1, ['['] = 1, [']'] = 1,
+  ['*'] = 1, ['Y'] = 1, ['^'] = 1, ['V'] = 1, ['$'] = 1
+};
+
+
+/* Add (sign 1) or remove (sign -1) words first to last of a page from its
+ * summary. Signature matches overlapping these words are counted, too.
+ */
+void rf_page_summary_update(rfvm_t *vm, rfpage_t *page, int first, int last, int sign) {
+  unsigned int num_opcodes = 0, num_signatures = 0;
+  int i, length = (int)vm->signature.length;
+
+  for (i=first; i<=last; i++) {
+    num_opcodes += rf_opcodes[(guint8)page->data[i]];
+  }
+
+  if (length>0) {
+    for (i=MAX(0, first-length+1); i<=MIN(last, (int)vm->page_size-length); i++) {
+      if (memcmp(page->data+i, vm->signature.data, length)==0) {
+        num_signatures++;
+      }
+    }
+  }
+
+  page->summary.num_opcodes += sign*num_opcodes;
+  page->summary.num_signatures += sign*num_signatures;
+}
+
+
+/* Allocate memory page (words are left uninitialized). Words are put into
+ * the shared memory file, if the VM is exported and it has free slots.
+ */
+static rfpage_t *rf_page_new(rfvm_t *vm) {
+  rfpage_t *page;
+  rfword_t *data = NULL;
+
+  if (vm->export!=NULL) {
+    data = rf_export_alloc(vm->export);
+  }
+
+  if (data!=NULL) {
+    page = (rfpage_t*)g_malloc(sizeof(rfpage_t));
+    page->data = data;
+    page->export = vm->export;
+  }
+  else {
+    page = (rfpage_t*)g_malloc(sizeof(rfpage_t)+sizeof(rfword_t)*vm->page_size);
+    page->data = (rfword_t*)(page+1);
+    page->export = NULL;
+  }
+  page->refs = 1;
+  page->dirty = FALSE;
+  page->window = FALSE;
+  page->heat = 0;
+  page->cold = 0;
+  page->tier_writes = 0;
+  page->arena = NULL;
+  page->packed = NULL;
+  page->packed_size = 0;
+  page->traces = NULL;
+  memset(&page->summary, 0, sizeof(page->summary));
+  memset(&page->shadow, 0, sizeof(page->shadow));
+
+  return page;
+}
+
+
+/* Release memory page, it's freed when no VM uses it anymore
+ * NOTE: Traces must have been dropped before.
+ */
+static void rf_page_unref(void *data) {
+  rfpage_t *page = (rfpage_t*)data;
+
+  if (g_atomic_int_dec_and_test(&page->refs)) {
+    /* pages of the window are kept by the window */
+    if (page->window) {
+      return;
+    }
+    if (page->export!=NULL) {
+      rf_export_release(page->export, page->data);
+    }
+    if (page->arena!=NULL) {
+      rf_tier_release(page);
+    }
+    g_free(page->packed);
+    g_slist_free(page->traces);
+    rf_provenance_free(page);
+    g_free(page);
+  }
+}
+
+
+/* Get virtual page (generated, but not in memory) */
+static rfpage_t *rf_memory_virtual_page(rfvm_t *vm, int pid) {
+  unsigned int slot = (unsigned int)pid&(RFMEM_VIRTUAL_PAGES-1);
+  rfpage_t *page = vm->virtual_pages.pages[slot];
+
+  if (page!=NULL && vm->virtual_pages.pids[slot]==pid) {
+    return page;
+  }
+
+  if (page==NULL) {
+    page = (rfpage_t*)g_malloc0(sizeof(rfpage_t)+sizeof(rfword_t)*vm->page_size);
+    page->data = (rfword_t*)(page+1);
+    vm->virtual_pages.pages[slot] = page;
+  }
+  else {
+    /* page is reused, TLBs may still have it */
+    rf_memory_invalidate(vm);
+  }
+
+  vm->virtual_pages.pids[slot] = pid;
+  rf_rand_page(vm, page, pid);
+  vm->virtual_pages.num_generated++;
+
+  return page;
+}
+
+
+/* Put virtual page into memory (it's about to be written). Returns the page
+ * in memory.
+ */
+static rfpage_t *rf_memory_materialize_page(rfvm_t *vm, int pid, rfpage_t *page) {
+  rfpage_t *copy;
+
+  /* pages of the window stay in place */
+  if (!page->window) {
+    vm->virtual_pages.pages[(unsigned int)pid&(RFMEM_VIRTUAL_PAGES-1)] = NULL;
+
+    /* words of exported VMs belong into the shared memory file */
+    if (vm->export!=NULL) {
+      copy = rf_page_new(vm);
+      memcpy(copy->data, page->data, sizeof(rfword_t)*vm->page_size);
+      g_free(page);
+      page = copy;
+      rf_memory_invalidate(vm);
+    }
+  }
+
+  page->refs = 1;
+  rf_page_summary_update(vm, page, 0, vm->page_size-1, 1);
+  g_tree_insert(vm->memory, GINT_TO_POINTER(pid), page);
+  vm->virtual_pages.num_materialized++;
+
+  if (G_UNLIKELY(vm->events.types&RFEVENT_PAGE)) {
+    rf_event_emit(vm, RFEVENT_PAGE, 0, 0, 0, pid);
+  }
+
+  return page;
+}
+
+
+/* Free virtual pages (e.g. when their pages are put into memory otherwise) */
+static void rf_memory_drop_virtual(rfvm_t *vm) {
+  unsigned int i;
+
+  for (i=0; i<RFMEM_VIRTUAL_PAGES; i++) {
+    g_free(vm->virtual_pages.pages[i]);
+    vm->virtual_pages.pages[i] = NULL;
+  }
+  rf_memory_invalidate(vm);
+}
+
+
+/* Get memory page, bypassing the first way of the TLB */
+rfpage_t *rf_memory_lookup_page_slow(rfvm_t *vm, int pid, struct rfth_tlb *tlb) {
+  struct rfth_tlb_entry *set = NULL;
+  struct rfth_tlb_entry entry;
+  rfpage_t *page;
+  unsigned int way;
+
+  /* try to look in thread's TLB */
+  if (tlb!=NULL) {
+    /* flush TLB if memory generation changed */
+    if (tlb->generation!=vm->generation) {
+      memset(tlb->sets, 0, sizeof(tlb->sets));
+      tlb->generation = vm->generation;
+    }
+
+    set = tlb->sets[pid&(RFTH_TLB_SETS-1)];
+
+    for (way=0; way<RFTH_TLB_WAYS; way++) {
+      if (set[way].page!=NULL && set[way].pid==pid) {
+        /* move to front */
+        entry = set[way];
+        memmove(set+1, set, sizeof(struct rfth_tlb_entry)*way);
+        set[0] = entry;
+        tlb->hits++;
+        return entry.page;
+      }
+    }
+
+    tlb->misses++;
+  }
+
+  /* lookup page in memory tree */
+  page = g_tree_lookup(vm->memory, GINT_TO_POINTER(pid));
+
+  if (page==NULL) {
+    /* page wasn't written, generate it (it's put into memory on write) */
+    page = rf_memory_virtual_page(vm, pid);
+  }
+  else if (page->packed!=NULL) {
+    /* cold page (see tier.h) */
+    page = rf_tier_unpack(vm, pid, page);
+  }
+
+  /* cache page lookup, evicting least recently used way */
+  if (set!=NULL) {
+    memmove(set+1, set, sizeof(struct rfth_tlb_entry)*(RFTH_TLB_WAYS-1));
+    set[0].pid = pid;
+    set[0].page = page;
+  }
+
+  return page;
+}
+
+
+/* Replace a page shared with a clone by a private copy, or put a virtual
+ * page into memory. Returns the page that may be written.
+ * NOTE: Shared pages have no traces, see rf_trace_link().
+ */
+rfpage_t *rf_memory_unshare_page(rfvm_t *vm, int pid, rfpage_t *page) {
+  rfpage_t *copy;
+
+  if (g_atomic_int_get(&page->refs)==0) {
+    return rf_memory_materialize_page(vm, pid, page);
+  }
+
+  copy = rf_page_new(vm);
+  memcpy(copy->data, page->data, sizeof(rfword_t)*vm->page_size);
+  copy->summary = page->summary;
+  copy->dirty = page->dirty;
+  copy->heat = page->heat;
+  copy->cold = page->cold;
+  copy->tier_writes = page->tier_writes;
+  rf_provenance_copy(vm, copy, page);
+
+  /* releases our reference to the shared page */
+  g_tree_insert(vm->memory, GINT_TO_POINTER(pid), copy);
+  rf_memory_invalidate(vm);
+
+  vm->num_unshared++;
+
+  return copy;
+}
+
+
 /* Find matching paretheses */
-static rfp_t rf_find_matching_parentheses(rfvm_t *vm, rfp_t p, struct rfth_page_cache *page_cache) {
+static inline rfp_t rf_find_matching_parentheses(rfvm_t *vm, rfp_t p, struct rfth_tlb *tlb, const unsigned int page_shift) {
   unsigned int level = 1;
 
   for (p++; level>0; p++) {
-    switch (rf_memory_read(vm, p, page_cache)) {
+    switch (rf_memory_read_fast(vm, p, tlb, page_shift)) {
       case '[':
         level++;
         break;
@@ -110,60 +422,315 @@ static rfp_t rf_find_matching_parentheses(rfvm_t *vm, rfp_t p, struct rfth_page_
 
 
 
-/* Create new VM */
-rfvm_t *rf_vm_new_full(unsigned long seed, float rate_instr, float rate_mem, float rate_kill) {
+static const char *rf_engine_names[] = {
+  "interp",
+  "trace",
+  "native",
+  NULL
+};
+
+
+/* Get execution engine by name. Returns -1 for unknown names */
+int rf_engine_parse(const char *name) {
+  int i;
+
+  for (i=0; rf_engine_names[i]!=NULL; i++) {
+    if (strcmp(rf_engine_names[i], name)==0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+
+/* Get name of execution engine */
+const char *rf_engine_name(int engine) {
+  if (engine>=0 && engine<RFENGINE_NUM_ENGINES) {
+    return rf_engine_names[engine];
+  }
+  else {
+    return NULL;
+  }
+}
+
+
+static const char *rf_sched_policy_names[] = {
+  "rr",
+  "lottery",
+  "budget",
+  NULL
+};
+
+
+/* Get scheduler policy by name. Returns -1 for unknown names */
+int rf_sched_policy_parse(const char *name) {
+  int i;
+
+  for (i=0; rf_sched_policy_names[i]!=NULL; i++) {
+    if (strcmp(rf_sched_policy_names[i], name)==0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+
+/* Get name of scheduler policy */
+const char *rf_sched_policy_name(int policy) {
+  if (policy>=0 && policy<RFSCHED_NUM_POLICIES) {
+    return rf_sched_policy_names[policy];
+  }
+  else {
+    return NULL;
+  }
+}
+
+
+/* Initialize configuration with default values */
+void rf_conf_init(rfconf_t *conf) {
+  memset(conf, 0, sizeof(rfconf_t));
+  conf->page_size = RFMEM_PAGE_SIZE;
+  conf->max_threads = RFVM_MAX_THREADS;
+  conf->reaper = RFVM_REAPER;
+  conf->max_cycles = RFTH_MAX_CYCLES;
+  conf->scheduler = RFVM_SCHEDULER;
+  conf->quantum = RFVM_QUANTUM;
+  conf->budget = RFVM_BUDGET;
+  conf->engine = RFVM_ENGINE;
+  conf->initial_population = RFVM_INITIAL_POPULATION;
+  conf->initial_spread = RFVM_INITIAL_SPREAD;
+  conf->rate_instr = RFVM_RATE_INSTR;
+  conf->rate_mem = RFVM_RATE_MEM;
+  conf->rate_kill = RFVM_RATE_KILL;
+  conf->lineage = RFVM_LINEAGE;
+  conf->provenance = RFVM_PROVENANCE;
+  conf->evict_interval = RFVM_EVICT_INTERVAL;
+  conf->window = RFVM_WINDOW;
+  conf->tier_interval = RFVM_TIER_INTERVAL;
+  conf->tier_hot = RFVM_TIER_HOT;
+  conf->monitor_window = RFVM_MONITOR_WINDOW;
+  conf->monitor_tolerance = RFVM_MONITOR_TOLERANCE;
+  conf->monitor_fixation = RFVM_MONITOR_FIXATION;
+}
+
+
+/* Load configuration from key file. Keys missing in the file are left untouched */
+gboolean rf_conf_load(rfconf_t *conf, const char *filename, GError **error) {
+  GKeyFile *keyfile;
+  GError *tmp_error = NULL;
+  gchar *str;
+
+  keyfile = g_key_file_new();
+  if (!g_key_file_load_from_file(keyfile, filename, G_KEY_FILE_NONE, error)) {
+    g_key_file_free(keyfile);
+    return FALSE;
+  }
+
+#define RF_CONF_GET(key, getter) \
+  if (tmp_error==NULL && g_key_file_has_key(keyfile, RFCONF_GROUP, #key, NULL)) { \
+    conf->key = getter(keyfile, RFCONF_GROUP, #key, &tmp_error); \
+  }
+#define RF_CONF_GET_ENUM(key, parse) \
+  if (tmp_error==NULL && g_key_file_has_key(keyfile, RFCONF_GROUP, #key, NULL)) { \
+    str = g_key_file_get_string(keyfile, RFCONF_GROUP, #key, &tmp_error); \
+    if (str!=NULL && (conf->key = parse(str))<0) { \
+      g_set_error(&tmp_error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE, "Invalid value for key '%s': %s", #key, str); \
+    } \
+    g_free(str); \
+  }
+
+  RF_CONF_GET(seed, g_key_file_get_uint64);
+  RF_CONF_GET(page_size, g_key_file_get_integer);
+  RF_CONF_GET(max_threads, g_key_file_get_integer);
+  RF_CONF_GET_ENUM(reaper, rf_reaper_policy_parse);
+  RF_CONF_GET(max_cycles, g_key_file_get_integer);
+  RF_CONF_GET_ENUM(scheduler, rf_sched_policy_parse);
+  RF_CONF_GET(quantum, g_key_file_get_integer);
+  RF_CONF_GET(budget, g_key_file_get_integer);
+  RF_CONF_GET_ENUM(engine, rf_engine_parse);
+  RF_CONF_GET(initial_population, g_key_file_get_integer);
+  RF_CONF_GET(initial_spread, g_key_file_get_uint64);
+  RF_CONF_GET(rate_instr, g_key_file_get_double);
+  RF_CONF_GET(rate_mem, g_key_file_get_double);
+  RF_CONF_GET(rate_kill, g_key_file_get_double);
+  RF_CONF_GET(lineage, g_key_file_get_integer);
+  RF_CONF_GET(provenance, g_key_file_get_boolean);
+  RF_CONF_GET(evict_interval, g_key_file_get_integer);
+  RF_CONF_GET(window, g_key_file_get_integer);
+  RF_CONF_GET(tier_interval, g_key_file_get_integer);
+  RF_CONF_GET(tier_hot, g_key_file_get_integer);
+  RF_CONF_GET(monitor_window, g_key_file_get_integer);
+  RF_CONF_GET(monitor_tolerance, g_key_file_get_double);
+  RF_CONF_GET(monitor_fixation, g_key_file_get_double);
+
+#undef RF_CONF_GET
+#undef RF_CONF_GET_ENUM
+
+  g_key_file_free(keyfile);
+
+  if (tmp_error!=NULL) {
+    g_propagate_error(error, tmp_error);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+/* Create new VM
+ * NOTE: Returns NULL if the page size isn't a power of 2 (up to
+ *       RFMEM_MAX_PAGE_SIZE), quantum is 0 or the lottery or budget
+ *       scheduler has a budget of 0 (which would run nothing)
+ */
+rfvm_t *rf_vm_new_full(const rfconf_t *conf) {
   rfvm_t *vm;
+  unsigned int page_shift;
+
+  /* page size must be a power of 2 (negative sizes from key files are huge) */
+  if (conf->page_size==0 || conf->page_size>RFMEM_MAX_PAGE_SIZE || conf->quantum==0) {
+    return NULL;
+  }
+  if (conf->scheduler!=RFSCHED_ROUND_ROBIN && conf->budget==0) {
+    return NULL;
+  }
+  for (page_shift=0; (1U<<page_shift)<conf->page_size; page_shift++);
+  if ((1U<<page_shift)!=conf->page_size) {
+    return NULL;
+  }
 
   vm = (rfvm_t*)g_malloc(sizeof(rfvm_t));
   memset(vm, 0, sizeof(rfvm_t));
-  vm->memory = g_tree_new_full(rf_memory_pid_compare, vm, NULL, g_free);
-  vm->threads = g_ptr_array_new_with_free_func(g_free);
+  memcpy(&vm->conf, conf, sizeof(rfconf_t));
+  vm->page_size = conf->page_size;
+  vm->page_shift = page_shift;
+  vm->memory = g_tree_new_full(rf_memory_pid_compare, vm, NULL, rf_page_unref);
+  vm->threads = g_ptr_array_new();
   vm->rand = gsl_rng_alloc(gsl_rng_taus);
-  gsl_rng_set(vm->rand, seed);
-  vm->mutations.rate_instr = rate_instr;
-  vm->mutations.rate_mem = rate_mem;
-  vm->mutations.rate_kill = rate_kill;
+
+  /* seed GSL's random number generator with glib's, if no seed is given */
+  if (vm->conf.seed==0) {
+    vm->conf.seed = (unsigned long)g_random_int();
+  }
+  gsl_rng_set(vm->rand, vm->conf.seed);
+
+  vm->mutations.rate_instr = conf->rate_instr;
+  vm->mutations.rate_mem = conf->rate_mem;
+  vm->mutations.rate_kill = conf->rate_kill;
+  vm->mutations.next_instr = rf_rand_mutation(vm, vm->mutations.rate_instr);
+  vm->mutations.next_mem = rf_rand_mutation(vm, vm->mutations.rate_mem);
+  vm->mutations.next_kill = rf_rand_mutation(vm, vm->mutations.rate_kill);
+
+  rf_trace_init(vm);
+
+  if (conf->lineage>0) {
+    vm->lineage = rf_lineage_new(conf->lineage);
+  }
+
+  /* without window, all pages are kept in the memory tree */
+  if (conf->window>0) {
+    rf_window_init(vm, conf->window);
+  }
+
+  if (conf->tier_interval>0) {
+    rf_tier_init(vm);
+  }
 
   return vm;
 }
 
+rfvm_t *rf_vm_new_with_seed(unsigned long seed) {
+  rfconf_t conf;
+
+  rf_conf_init(&conf);
+  conf.seed = seed;
+
+  return rf_vm_new_full(&conf);
+}
+
 rfvm_t *rf_vm_new(void) {
-  unsigned long seed;
+  return rf_vm_new_with_seed(0);
+}
 
-  /* seed GSL's random number generator with glib's */
-  seed = (unsigned long)g_random_int();
 
-  return rf_vm_new_full(seed, 0.000001, 0.00001, 0.000001);
+/* Allocate thread and append it to the thread list */
+static rfth_t *rf_thread_new(rfvm_t *vm, rfp_t ip, rfp_t dp, rfp_t sp) {
+  rfth_t *thread;
+
+  thread = (rfth_t*)g_malloc(sizeof(rfth_t));
+  memset(thread, 0, sizeof(rfth_t));
+  thread->ip = ip;
+  thread->dp = dp;
+  thread->sp = sp;
+  thread->sb = sp;
+  thread->id = ++vm->last_id;
+
+  g_ptr_array_add(vm->threads, thread);
+  rf_reaper_push(vm, thread);
+
+  /* lottery tickets: code size up to the next 0 marker */
+  thread->tickets = 1;
+  if (vm->conf.scheduler==RFSCHED_LOTTERY) {
+    for (; thread->tickets<RFTH_MAX_TICKETS; thread->tickets++) {
+      if (rf_memory_read(vm, ip+thread->tickets, &thread->tlb)==0) {
+        break;
+      }
+    }
+  }
+
+  return thread;
 }
 
 
-/* Free VM */
-void rf_vm_free(rfvm_t *vm) {
-  gsl_rng_free(vm->rand);
-  g_tree_unref(vm->memory);
-  g_ptr_array_free(vm->threads, TRUE);
+/* Free thread */
+static void rf_thread_free(rfvm_t *vm, rfth_t *thread) {
+  if (vm->lineage!=NULL) {
+    rf_lineage_death(vm, thread);
+  }
+  vm->tlb_hits += thread->tlb.hits;
+  vm->tlb_misses += thread->tlb.misses;
+  g_slist_free(thread->pstack);
+  g_free(thread);
 }
 
 
-/* Create thread */
-rfth_t *rf_thread_add_full(rfvm_t *vm, rfp_t ip, rfp_t dp, rfp_t sp, const rfword_t *code, int code_length) {
+/* Record birth of thread with its code in place, forked by parent (NULL if
+ * it wasn't forked)
+ */
+static void rf_thread_born(rfvm_t *vm, rfth_t *thread, rfth_t *parent) {
+  if (vm->lineage!=NULL || vm->conf.monitor_window>0) {
+    thread->genotype = rf_lineage_genotype(vm, thread);
+  }
+  if (vm->lineage!=NULL) {
+    rf_lineage_birth(vm, thread, parent);
+  }
+  if (G_UNLIKELY(vm->events.types&RFEVENT_BIRTH)) {
+    rf_event_emit(vm, RFEVENT_BIRTH, thread->id, parent!=NULL ? parent->id : 0, 0, thread->ip);
+  }
+}
+
+
+/* Create thread, forked by parent (NULL if it isn't forked) */
+static rfth_t *rf_thread_spawn(rfvm_t *vm, rfth_t *parent, rfp_t ip, rfp_t dp, rfp_t sp, const rfword_t *code, int code_length) {
   rfth_t *thread;
 
-#ifdef rfVM_MAX_THREADS
-  if (vm->threads->len>=RFVM_MAX_THREADS) {
+  if (rf_memory_read(vm, ip, NULL)!=0) {
     return NULL;
   }
-#endif
 
-  if (rf_memory_read(vm, ip, NULL)!=0) {
-    return NULL;
+  /* enforce thread cap */
+  if (vm->conf.max_threads>0 && rf_get_num_threads(vm)>=vm->conf.max_threads) {
+    thread = rf_reaper_select(vm);
+    if (thread==NULL) {
+      return NULL;
+    }
+    thread->death = RFDEATH_REAPED;
+    rf_thread_kill(vm, thread);
+    vm->reaper.num_reaped++;
   }
 
-  thread = (rfth_t*)g_malloc(sizeof(rfth_t));
-  memset(thread, 0, sizeof(rfth_t));
-  thread->ip = ip;
-  thread->dp = dp;
-  thread->sp = sp;
+  thread = rf_thread_new(vm, ip, dp, sp);
 
   if (code!=NULL) {
     /* load code */
@@ -173,45 +740,270 @@ rfth_t *rf_thread_add_full(rfvm_t *vm, rfp_t ip, rfp_t dp, rfp_t sp, const rfwor
     rf_load_data(vm, thread->ip, code, code_length);
   }
 
-  g_ptr_array_add(vm->threads, thread);
+  rf_thread_born(vm, thread, parent);
+
+  return thread;
+}
+
+/* Create thread */
+rfth_t *rf_thread_add_full(rfvm_t *vm, rfp_t ip, rfp_t dp, rfp_t sp, const rfword_t *code, int code_length) {
+  return rf_thread_spawn(vm, NULL, ip, dp, sp, code, code_length);
+}
+
+rfth_t *rf_thread_add(rfvm_t *vm) {
+  return rf_thread_add_full(vm, 0, 0, 0, NULL, -1);
+}
+
+
+/* Kill thread. It's removed at the end of the current cycle */
+void rf_thread_kill(rfvm_t *vm, rfth_t *thread) {
+  if (!thread->dead) {
+    thread->dead = TRUE;
+    rf_reaper_unlink(vm, thread);
+    vm->reaper.num_dead++;
+
+    if (G_UNLIKELY(vm->events.types&RFEVENT_DEATH)) {
+      rf_event_emit(vm, RFEVENT_DEATH, thread->id, 0, thread->death, thread->ip);
+    }
+  }
+}
+
+
+/* Remove thread immediately
+ * NOTE: Don't call this while a cycle is running, use rf_thread_kill() instead
+ */
+void rf_thread_remove(rfvm_t *vm, rfth_t *thread) {
+  rf_thread_kill(vm, thread);
+  vm->reaper.num_dead--;
+  g_ptr_array_remove_fast(vm->threads, thread);
+  rf_thread_free(vm, thread);
+}
+
+
+/* Remove all killed threads (keeps order of remaining threads) */
+static void rf_thread_remove_dead(rfvm_t *vm) {
+  unsigned int i, j;
+  rfth_t *thread;
+
+  for (i=0, j=0; i<vm->threads->len; i++) {
+    thread = g_ptr_array_index(vm->threads, i);
+    if (thread->dead) {
+      rf_thread_free(vm, thread);
+    }
+    else {
+      vm->threads->pdata[j++] = thread;
+    }
+
+    /* keep scheduler cursor on the same thread */
+    if (i+1==vm->sched.cursor) {
+      vm->sched.cursor = j;
+    }
+  }
+
+  g_ptr_array_set_size(vm->threads, j);
+
+  vm->reaper.num_dead = 0;
+}
+
+
+/* Free VM */
+void rf_vm_free(rfvm_t *vm) {
+  unsigned int i;
+
+  for (i=0; i<vm->threads->len; i++) {
+    rf_thread_free(vm, g_ptr_array_index(vm->threads, i));
+  }
+
+  rf_trace_destroy(vm);
+  rf_memory_drop_virtual(vm);
+  rf_event_free(vm);
+  if (vm->lineage!=NULL) {
+    rf_lineage_free(vm->lineage);
+  }
+  gsl_rng_free(vm->rand);
+  g_tree_unref(vm->memory);
+  rf_window_free(vm);
+  rf_tier_free(vm);
+  if (vm->export!=NULL) {
+    rf_export_unref(vm->export);
+  }
+  g_free(vm->signature.data);
+  g_ptr_array_free(vm->threads, TRUE);
+  g_free(vm);
+}
+
+
+/* Iterator: shares a page with a clone. Pages of the window are copied. */
+static gboolean rf_vm_clone_page(void *key, void *value, void *userdata) {
+  rfvm_t *clone = (rfvm_t*)userdata;
+  rfpage_t *page = (rfpage_t*)value, *copy;
+  int pid = GPOINTER_TO_INT(key);
+
+  if (page->window) {
+    copy = rf_window_has_page(clone, pid) ? rf_window_page(clone, pid) : rf_page_new(clone);
+    copy->refs = 1;
+    memcpy(copy->data, page->data, sizeof(rfword_t)*clone->page_size);
+    copy->summary = page->summary;
+    copy->dirty = page->dirty;
+    rf_provenance_copy(clone, copy, page);
+    g_tree_insert(clone->memory, key, copy);
+  }
+  else {
+    g_atomic_int_inc(&page->refs);
+    g_tree_insert(clone->memory, key, page);
+  }
+
+  return FALSE;
+}
+
+
+/* Clone VM including threads and random number generator state, so that the
+ * clone continues exactly like the original would. Memory pages are shared
+ * and copied when either VM writes them, so cloning is cheap (except for
+ * pages of the memory window, see window.h). Event hooks aren't copied.
+ * NOTE: This flushes the trace cache of the original VM, since pages with
+ *       traces must not be shared.
+ */
+rfvm_t *rf_vm_clone(rfvm_t *vm) {
+  rfvm_t *clone;
+  rfth_t *thread, *copy;
+  GHashTable *copies;
+  unsigned int i;
+
+  rf_trace_flush(vm);
+  rf_tier_flush(vm);
+
+  clone = (rfvm_t*)g_malloc(sizeof(rfvm_t));
+  memcpy(clone, vm, sizeof(rfvm_t));
+  clone->rand = gsl_rng_clone(vm->rand);
+  clone->memory = g_tree_new_full(rf_memory_pid_compare, clone, NULL, rf_page_unref);
+  memset(&clone->window, 0, sizeof(clone->window));
+  if (vm->window.data!=NULL) {
+    rf_window_init(clone, vm->window.num_pages);
+  }
+  if (vm->tier.arena!=NULL) {
+    rf_tier_init(clone);
+  }
+  g_tree_foreach(vm->memory, rf_vm_clone_page, clone);
+  rf_trace_init(clone);
+  memset(clone->virtual_pages.pages, 0, sizeof(clone->virtual_pages.pages));
+  memset(&clone->events, 0, sizeof(clone->events));
+
+  clone->signature.data = g_memdup(vm->signature.data, vm->signature.length);
+  if (vm->lineage!=NULL) {
+    clone->lineage = rf_lineage_copy(vm->lineage);
+  }
+
+  /* shared pages may be in the original's memory file, so keep it */
+  if (clone->export!=NULL) {
+    g_atomic_int_inc(&clone->export->refs);
+  }
+
+  /* copy threads in the same order (the scheduler cursor stays valid) */
+  clone->threads = g_ptr_array_sized_new(vm->threads->len);
+  copies = g_hash_table_new(g_direct_hash, g_direct_equal);
+  for (i=0; i<vm->threads->len; i++) {
+    thread = g_ptr_array_index(vm->threads, i);
+    copy = (rfth_t*)g_memdup(thread, sizeof(rfth_t));
+    copy->pstack = g_slist_copy(thread->pstack);
+    copy->reap_prev = NULL;
+    copy->reap_next = NULL;
+    memset(&copy->tlb, 0, sizeof(copy->tlb));
+    g_ptr_array_add(clone->threads, copy);
+    g_hash_table_insert(copies, thread, copy);
+  }
+
+  /* rebuild reaper queue in the same order */
+  clone->reaper.top = NULL;
+  clone->reaper.bottom = NULL;
+  for (thread=vm->reaper.top; thread!=NULL; thread=thread->reap_next) {
+    rf_reaper_push(clone, g_hash_table_lookup(copies, thread));
+  }
+  g_hash_table_destroy(copies);
+
+  return clone;
+}
+
 
-  return thread;
+/* Change mutation rates (e.g. of a clone). Next mutations are drawn again */
+void rf_vm_set_mutation_rates(rfvm_t *vm, double rate_instr, double rate_mem, double rate_kill) {
+  vm->conf.rate_instr = vm->mutations.rate_instr = rate_instr;
+  vm->conf.rate_mem = vm->mutations.rate_mem = rate_mem;
+  vm->conf.rate_kill = vm->mutations.rate_kill = rate_kill;
+  vm->mutations.next_instr = rf_rand_mutation(vm, rate_instr);
+  vm->mutations.next_mem = rf_rand_mutation(vm, rate_mem);
+  vm->mutations.next_kill = rf_rand_mutation(vm, rate_kill);
 }
 
-rfth_t *rf_thread_add(rfvm_t *vm) {
-  return rf_thread_add_full(vm, 0, 0, 0, NULL, -1);
+
+/* Iterator: counts signature matches of a page again */
+static gboolean rf_vm_set_signature_iter(void *key, void *value, void *userdata) {
+  rfvm_t *vm = (rfvm_t*)userdata;
+  rfpage_t *page = (rfpage_t*)value;
+
+  page->summary.num_opcodes = 0;
+  page->summary.num_signatures = 0;
+  rf_page_summary_update(vm, page, 0, vm->page_size-1, 1);
+
+  return FALSE;
 }
 
+/* Set signature counted in page summaries (e.g. code of a program). Matches
+ * are counted on every write, so this slows the VM down. Length 0 disables it.
+ */
+void rf_vm_set_signature(rfvm_t *vm, const rfword_t *signature, unsigned int length) {
+  g_free(vm->signature.data);
+  vm->signature.data = NULL;
+  vm->signature.length = 0;
+  if (length>0 && length<=vm->page_size) {
+    vm->signature.data = g_memdup(signature, length);
+    vm->signature.length = length;
+  }
 
-/* Remove thread */
-void rf_thread_remove(rfvm_t *vm, rfth_t *thread) {
-  g_ptr_array_remove_fast(vm->threads, thread);
+  rf_tier_flush(vm);
+  g_tree_foreach(vm->memory, rf_vm_set_signature_iter, vm);
 }
 
 
-/* Run a cycle in thread */
-gboolean rf_thread_cycle(rfvm_t *vm, rfth_t *thread) {
+/* Run a cycle in thread
+ * NOTE: This is inlined with constant page shifts for the common page sizes,
+ *       see rf_vm_cycle().
+ */
+static inline gboolean rf_thread_cycle_specialised(rfvm_t *vm, rfth_t *thread, const unsigned int page_shift) {
   rfp_t ip, pp;
   rfword_t instr, data;
 
+  thread->backedge = FALSE;
+  thread->stackop = FALSE;
+
   /* memory mutation */
-  if (rf_rand_mutation(vm, vm->mutations.rate_mem)) {
+  if (--vm->mutations.next_mem==0) {
+    vm->mutations.next_mem = rf_rand_mutation(vm, vm->mutations.rate_mem);
     rf_memory_mutate(vm);
   }
 
   /* kill mutation */
-  if (rf_rand_mutation(vm, vm->mutations.rate_kill)) {
+  if (--vm->mutations.next_kill==0) {
+    vm->mutations.next_kill = rf_rand_mutation(vm, vm->mutations.rate_kill);
     vm->mutations.num_kill++;
+    if (G_UNLIKELY(vm->events.types&RFEVENT_MUTATION)) {
+      rf_event_emit(vm, RFEVENT_MUTATION, thread->id, 0, RFMUTATION_KILL, thread->ip);
+    }
+    thread->death = RFDEATH_MUTATION;
     return FALSE;
   }
 
   /* when an mutation occurs, the instruction is ignored */
-  if (rf_rand_mutation(vm, vm->mutations.rate_instr)) {
+  if (--vm->mutations.next_instr==0) {
+    vm->mutations.next_instr = rf_rand_mutation(vm, vm->mutations.rate_instr);
     vm->mutations.num_instr++;
+    if (G_UNLIKELY(vm->events.types&RFEVENT_MUTATION)) {
+      rf_event_emit(vm, RFEVENT_MUTATION, thread->id, 0, RFMUTATION_INSTR, thread->ip);
+    }
   }
   else {
     ip = thread->ip;
-    instr = rf_memory_read(vm, ip, &thread->page_cache_ip);
+    instr = rf_memory_read_fast(vm, ip, &thread->tlb, page_shift);
 
     switch (instr) {
       /* increment data pointer */
@@ -226,28 +1018,28 @@ gboolean rf_thread_cycle(rfvm_t *vm, rfth_t *thread) {
 
       /* increment word at data pointer */
       case '+':
-        data = rf_memory_read(vm, thread->dp, &thread->page_cache_dp);
-        rf_memory_write(vm, thread->dp, data+1, &thread->page_cache_dp);
+        data = rf_memory_read_fast(vm, thread->dp, &thread->tlb, page_shift);
+        rf_memory_write_fast(vm, thread->dp, data+1, &thread->tlb, page_shift);
         break;
 
       /* decrement word at data pointer */
       case '-':
-        data = rf_memory_read(vm, thread->dp, &thread->page_cache_dp);
-        rf_memory_write(vm, thread->dp, data-1, &thread->page_cache_dp);
+        data = rf_memory_read_fast(vm, thread->dp, &thread->tlb, page_shift);
+        rf_memory_write_fast(vm, thread->dp, data-1, &thread->tlb, page_shift);
         break;
 
       /* set word at data pointer to random value */
       case ',':
         rf_rand(vm, &data, sizeof(data));
-        rf_memory_write(vm, thread->dp, data, &thread->page_cache_dp);
+        rf_memory_write_fast(vm, thread->dp, data, &thread->tlb, page_shift);
         break;
 
       /* open parentheses */
       case '[':
-        data = rf_memory_read(vm, thread->dp, &thread->page_cache_dp);
+        data = rf_memory_read_fast(vm, thread->dp, &thread->tlb, page_shift);
         if (data==0) {
           /* jump to matching parentheses */
-          thread->ip = rf_find_matching_parentheses(vm, ip, &thread->page_cache_ip);
+          thread->ip = rf_find_matching_parentheses(vm, ip, &thread->tlb, page_shift);
         }
         else if (thread->pstack==NULL || GPOINTER_TO_INT(thread->pstack->data)!=ip) {
           /* push pointer to this parentheses on stack */
@@ -257,51 +1049,69 @@ gboolean rf_thread_cycle(rfvm_t *vm, rfth_t *thread) {
 
       /* closed parentheses */
       case ']':
-        if (thread->pstack!=NULL) {
-          data = rf_memory_read(vm, thread->dp, &thread->page_cache_dp);
+        if (thread->pstack==NULL) {
+          /* unmatched ']', ignore */
+          rf_reaper_error(vm, thread);
+        }
+        else {
+          data = rf_memory_read_fast(vm, thread->dp, &thread->tlb, page_shift);
           pp = GPOINTER_TO_INT(thread->pstack->data);
           /* check if '[' is still there */
-          if (rf_memory_read(vm, pp, &thread->page_cache_ip)=='[') {
+          if (rf_memory_read_fast(vm, pp, &thread->tlb, page_shift)=='[') {
             if (data!=0) {
               /* jump back to matching parentheses (pop from stack) */
               thread->ip = pp-1;
+              thread->backedge = TRUE;
             }
             else {
               thread->pstack = g_slist_delete_link(thread->pstack, thread->pstack);
             }
           }
+          else {
+            rf_reaper_error(vm, thread);
+          }
         }
-        /* else: unmatched ']', ignore */
         break;
 
       /* kills thread */
       case '*':
+        thread->death = RFDEATH_HALTED;
         return FALSE;
   
       /* fork - create another thread with IP & DP set to current thread's DP */
       case 'Y':
-        rf_thread_add_full(vm, thread->dp, thread->dp, thread->dp, NULL, -1);
+        if (rf_thread_spawn(vm, thread, thread->dp, thread->dp, thread->dp, NULL, -1)!=NULL) {
+          rf_reaper_reward(vm, thread);
+        }
+        else {
+          rf_reaper_error(vm, thread);
+        }
         break;
 
       /* push word at DP to stack */
       case '^':
         thread->sp--;
-        data = rf_memory_read(vm, thread->dp, &thread->page_cache_dp);
-        rf_memory_write(vm, thread->sp, data, &thread->page_cache_sp);
+        vm->stack.shared += rf_memory_move_fast(vm, thread->dp, thread->sp, &thread->tlb, page_shift);
+        vm->stack.pushes++;
+        rf_stack_push_bounds(vm, thread);
+        thread->stackop = TRUE;
         break;
 
       /* pop word from stack to DP */
       case 'V':
-        data = rf_memory_read(vm, thread->sp, &thread->page_cache_sp);
-        rf_memory_write(vm, thread->dp, data, &thread->page_cache_dp);
+        vm->stack.shared += rf_memory_move_fast(vm, thread->sp, thread->dp, &thread->tlb, page_shift);
         thread->sp++;
+        vm->stack.pops++;
+        rf_stack_pop_bounds(vm, thread);
+        thread->stackop = TRUE;
         break;
 
       /* set stack base */
       case '$':
+        /* NOTE: SP shares the TLB with DP, so SP's page is already cached */
         thread->sp = thread->dp;
-        /* copy dp page cache to sp page cache */
-        //memcpy(&thread->page_cache_sp, &thread->page_cache_dp, sizeof(struct rfth_page_cache));
+        thread->sb = thread->dp;
+        vm->stack.num_bases++;
         break;
     }
   }
@@ -309,24 +1119,215 @@ gboolean rf_thread_cycle(rfvm_t *vm, rfth_t *thread) {
   thread->ip++;
   thread->clock++;
 
-  return thread->clock<RFTH_MAX_CYCLES;
+  if (vm->conf.max_cycles>0 && thread->clock>=vm->conf.max_cycles) {
+    thread->death = RFDEATH_AGE;
+    return FALSE;
+  }
+
+  return TRUE;
 }
 
 
-/* Run a cycle in all threads */
-void rf_vm_cycle(rfvm_t *vm) {
+gboolean rf_thread_cycle(rfvm_t *vm, rfth_t *thread) {
+  gboolean alive;
+
+  vm->writer = thread->id;
+  switch (vm->page_shift) {
+    case 10:
+      alive = rf_thread_cycle_specialised(vm, thread, 10);
+      break;
+    case 12:
+      alive = rf_thread_cycle_specialised(vm, thread, 12);
+      break;
+    case 16:
+      alive = rf_thread_cycle_specialised(vm, thread, 16);
+      break;
+    default:
+      alive = rf_thread_cycle_specialised(vm, thread, vm->page_shift);
+      break;
+  }
+  vm->writer = RFPROV_NONE;
+
+  return alive;
+}
+
+
+/* Run up to n instructions in thread. Returns number of executed instructions */
+static inline unsigned int rf_thread_run_specialised(rfvm_t *vm, rfth_t *thread, unsigned int n, const unsigned int page_shift) {
+  unsigned int i, k;
+
+  vm->writer = thread->id;
+
+  for (i=0; i<n && !thread->dead;) {
+    /* hot loops are run from the trace cache */
+    if (thread->backedge && vm->conf.engine!=RFENGINE_INTERP) {
+      k = rf_trace_run(vm, thread, n-i);
+      if (k>0) {
+        i += k;
+        continue;
+      }
+    }
+
+    /* so are runs of pushes or pops */
+    if (thread->stackop && vm->conf.engine!=RFENGINE_INTERP) {
+      k = rf_stack_run(vm, thread, n-i);
+      if (k>0) {
+        i += k;
+        continue;
+      }
+    }
+
+    i++;
+    if (!rf_thread_cycle_specialised(vm, thread, page_shift)) {
+      rf_thread_kill(vm, thread);
+    }
+  }
+
+  vm->instructions += i;
+  vm->writer = RFPROV_NONE;
+
+  return i;
+}
+
+
+/* Cumulative lottery tickets of the first n threads. Dead threads have none */
+static void rf_vm_lottery_tickets(rfvm_t *vm, guint64 *tickets, unsigned int n) {
   unsigned int i;
+  guint64 ticket;
   rfth_t *thread;
 
-  for (i=0; i<vm->threads->len; i++) {
+  for (i=0, ticket=0; i<n; i++) {
     thread = g_ptr_array_index(vm->threads, i);
-    if (!rf_thread_cycle(vm, thread)) {
-      rf_thread_remove(vm, thread);
-      i--;
+    if (!thread->dead) {
+      ticket += thread->tickets;
+    }
+    tickets[i] = ticket;
+  }
+}
+
+/* Scheduler: lottery, threads existing at the beginning of the cycle take
+ * part, each with its code size as tickets
+ */
+static inline void rf_vm_cycle_lottery(rfvm_t *vm, const unsigned int page_shift) {
+  unsigned int i, n, lo, hi, budget;
+  guint64 *tickets, ticket;
+  rfth_t *thread;
+
+  n = vm->threads->len;
+  if (n==0) {
+    return;
+  }
+
+  tickets = g_new(guint64, n);
+  rf_vm_lottery_tickets(vm, tickets, n);
+
+  for (budget=0; budget<vm->conf.budget && tickets[n-1]>0;) {
+    /* draw ticket and find its owner */
+    ticket = (guint64)(gsl_rng_uniform(vm->rand)*tickets[n-1]);
+    for (lo=0, hi=n-1; lo<hi;) {
+      i = (lo+hi)/2;
+      if (tickets[i]<=ticket) {
+        lo = i+1;
+      }
+      else {
+        hi = i;
+      }
+    }
+    thread = g_ptr_array_index(vm->threads, lo);
+
+    if (thread->dead) {
+      /* the thread died in this cycle: drop its tickets & draw again */
+      rf_vm_lottery_tickets(vm, tickets, n);
+    }
+    else {
+      budget += rf_thread_run_specialised(vm, thread, MIN(vm->conf.quantum, vm->conf.budget-budget), page_shift);
+    }
+  }
+
+  g_free(tickets);
+}
+
+
+/* Scheduler: budget, spent round robin from where the last cycle stopped */
+static inline void rf_vm_cycle_budget(rfvm_t *vm, const unsigned int page_shift) {
+  unsigned int budget, skipped = 0;
+  rfth_t *thread;
+
+  for (budget=0; budget<vm->conf.budget && skipped<vm->threads->len;) {
+    if (vm->sched.cursor>=vm->threads->len) {
+      vm->sched.cursor = 0;
+    }
+    thread = g_ptr_array_index(vm->threads, vm->sched.cursor++);
+
+    if (thread->dead) {
+      skipped++;
     }
+    else {
+      budget += rf_thread_run_specialised(vm, thread, MIN(vm->conf.quantum, vm->conf.budget-budget), page_shift);
+      skipped = 0;
+    }
+  }
+}
+
+
+/* Run a cycle in all threads */
+static inline void rf_vm_cycle_specialised(rfvm_t *vm, const unsigned int page_shift) {
+  unsigned int i;
+  rfth_t *thread;
+
+  switch (vm->conf.scheduler) {
+    case RFSCHED_LOTTERY:
+      rf_vm_cycle_lottery(vm, page_shift);
+      break;
+
+    case RFSCHED_BUDGET:
+      rf_vm_cycle_budget(vm, page_shift);
+      break;
+
+    default:
+      /* NOTE: threads forked in this cycle are run in this cycle, too */
+      for (i=0; i<vm->threads->len; i++) {
+        thread = g_ptr_array_index(vm->threads, i);
+        rf_thread_run_specialised(vm, thread, vm->conf.quantum, page_shift);
+      }
+      break;
+  }
+
+  if (vm->reaper.num_dead>0) {
+    rf_thread_remove_dead(vm);
   }
 
   vm->clock++;
+
+  if (vm->conf.evict_interval>0 && vm->clock%vm->conf.evict_interval==0) {
+    rf_memory_evict(vm);
+  }
+
+  if (vm->conf.tier_interval>0 && vm->clock%vm->conf.tier_interval==0) {
+    rf_tier_update(vm);
+  }
+
+  /* pass this cycle's events to hooks */
+  if (vm->events.types!=0) {
+    rf_event_flush(vm);
+  }
+}
+
+void rf_vm_cycle(rfvm_t *vm) {
+  switch (vm->page_shift) {
+    case 10:
+      rf_vm_cycle_specialised(vm, 10);
+      break;
+    case 12:
+      rf_vm_cycle_specialised(vm, 12);
+      break;
+    case 16:
+      rf_vm_cycle_specialised(vm, 16);
+      break;
+    default:
+      rf_vm_cycle_specialised(vm, vm->page_shift);
+      break;
+  }
 }
 
 
@@ -336,108 +1337,196 @@ void rf_vm_cycle(rfvm_t *vm) {
 void rf_memory_mutate(rfvm_t *vm) {
   rfword_t bitmask;
   unsigned int off;
+  rfp_t p;
   struct bt_memory_get_page_indexed_iterargs args;
 
+  /* only pages in memory are mutated (other pages are random anyway) */
+  if (g_tree_nnodes(vm->memory)==0) {
+    return;
+  }
+
   /* random page */
   args.idx = gsl_rng_uniform_int(vm->rand, g_tree_nnodes(vm->memory));
   g_tree_foreach(vm->memory, bt_memory_get_page_indexed_iter, &args);
 
   /* random offset */
-  off = gsl_rng_uniform_int(vm->rand, RFMEM_PAGE_SIZE);
+  off = gsl_rng_uniform_int(vm->rand, vm->page_size);
+
+  /* random bitmask (at least one bit) */
+  bitmask = (rfword_t)(gsl_rng_uniform_int(vm->rand, 0xFF)+1);
 
-  /* random bitmask */
-  bitmask = (rfword_t)gsl_rng_uniform(vm->rand);
-  
   /* flip bits */
-  args.page[off] ^= bitmask;
+  if (args.page->packed!=NULL) {
+    args.page = rf_tier_unpack(vm, args.pid, args.page);
+  }
+  if (g_atomic_int_get(&args.page->refs)>1) {
+    args.page = rf_memory_unshare_page(vm, args.pid, args.page);
+  }
+  rf_page_summary_update(vm, args.page, off, off, -1);
+  args.page->data[off] ^= bitmask;
+  rf_page_summary_update(vm, args.page, off, off, 1);
+  args.page->summary.num_writes++;
+  args.page->dirty = TRUE;
+  if (vm->conf.provenance) {
+    rf_provenance_write(vm, args.page, off, RFPROV_NONE);
+  }
+
+  if (args.page->traces!=NULL) {
+    p = (rfp_t)args.pid*vm->page_size+off;
+    rf_trace_invalidate(vm, args.page, p, p);
+  }
 
   vm->mutations.num_mem++;
+
+  if (G_UNLIKELY(vm->events.types&RFEVENT_MUTATION)) {
+    rf_event_emit(vm, RFEVENT_MUTATION, 0, 0, RFMUTATION_MEM, (rfp_t)args.pid*vm->page_size+off);
+  }
+}
+
+
+/* Invalidate all TLBs (must be called when pages are freed or moved) */
+void rf_memory_invalidate(rfvm_t *vm) {
+  vm->generation++;
 }
 
 
-/* Calculate page ID and offset from brainfuck pointer */
-static void rf_memory_get_pid_and_offset(rfp_t p, int *pid, unsigned int *off) {
-  if (p<0) {
-    p = -p;
-    *pid = -(p/RFMEM_PAGE_SIZE)-1;
+/* Free memory page. It'll be re-created with its initial content when
+ * accessed again
+ */
+gboolean rf_memory_free_page(rfvm_t *vm, int pid) {
+  rfpage_t *page;
+
+  page = g_tree_lookup(vm->memory, GINT_TO_POINTER(pid));
+  if (page!=NULL) {
+    rf_trace_invalidate_page(vm, page);
+    if (page->packed!=NULL) {
+      vm->tier.num_packed--;
+      vm->tier.packed_size -= page->packed_size;
+    }
+    g_tree_remove(vm->memory, GINT_TO_POINTER(pid));
+    if (page->window) {
+      rf_window_discard(vm, pid);
+    }
+    rf_memory_invalidate(vm);
+    return TRUE;
   }
   else {
-    *pid = p/RFMEM_PAGE_SIZE;
+    return FALSE;
   }
-  *off = p%RFMEM_PAGE_SIZE;
 }
 
 
-/* Get memory page */
-static rfword_t *rf_memory_lookup_page(rfvm_t *vm, int pid, struct rfth_page_cache *page_cache) {
-  rfword_t *page;
+/* Iterator: collects IDs of clean pages without traces */
+static gboolean rf_memory_evict_iter(void *key, void *value, void *userdata) {
+  rfpage_t *page = (rfpage_t*)value;
 
-  /* try to look in thread cache */
-  if (page_cache!=NULL && page_cache->page!=NULL && page_cache->pid==pid) {
-    return page_cache->page;
+  if (!page->dirty && page->traces==NULL) {
+    g_array_append_val((GArray*)userdata, key);
   }
-  else {
-    /* lookup page in memory tree */
-    page = g_tree_lookup(vm->memory, GINT_TO_POINTER(pid));
 
-    if (page==NULL) {
-      /* create page */
-      page = (rfword_t*)g_malloc(sizeof(rfword_t)*RFMEM_PAGE_SIZE);
-      rf_rand(vm, page, RFMEM_PAGE_SIZE);
-      g_tree_insert(vm->memory, GINT_TO_POINTER(pid), page);
-    }
+  return FALSE;
+}
 
-    /* cache page lookup */
-    if (page_cache!=NULL) {
-      page_cache->pid = pid;
-      page_cache->page = page;
-    }
+/* Free all clean pages (pages that weren't written since they were created).
+ * They're created again with the same content when accessed, so this doesn't
+ * change what threads see. Returns the number of freed pages.
+ * NOTE: Memory mutations only hit existing pages, so evictions change where
+ *       mutations occur.
+ */
+unsigned int rf_memory_evict(rfvm_t *vm) {
+  GArray *pids;
+  unsigned int i, n;
 
-    return page;
+  pids = g_array_new(FALSE, FALSE, sizeof(void*));
+  g_tree_foreach(vm->memory, rf_memory_evict_iter, pids);
+
+  for (i=0; i<pids->len; i++) {
+    g_tree_remove(vm->memory, g_array_index(pids, void*, i));
   }
+  n = pids->len;
+  g_array_free(pids, TRUE);
+
+  /* let the OS reuse memory of pages of the window that aren't in memory */
+  if (vm->window.data!=NULL) {
+    rf_window_evict(vm);
+  }
+
+  if (n>0) {
+    rf_memory_invalidate(vm);
+    vm->num_evicted += n;
+  }
+
+  return n;
 }
 
 
 /* Read word at position p */
-rfword_t rf_memory_read(rfvm_t *vm, rfp_t p, struct rfth_page_cache *page_cache) {
-  int pid;
-  unsigned int off;
-  rfword_t *page;
-
-  rf_memory_get_pid_and_offset(p, &pid, &off);
-  page = rf_memory_lookup_page(vm, pid, page_cache);
-  return page[off];
+rfword_t rf_memory_read(rfvm_t *vm, rfp_t p, struct rfth_tlb *tlb) {
+  return rf_memory_read_fast(vm, p, tlb, vm->page_shift);
 }
 
 
 /* Write word at position p */
-void rf_memory_write(rfvm_t *vm, rfp_t p, rfword_t data, struct rfth_page_cache *page_cache) {
+void rf_memory_write(rfvm_t *vm, rfp_t p, rfword_t data, struct rfth_tlb *tlb) {
+  rf_memory_write_fast(vm, p, data, tlb, vm->page_shift);
+}
+
+
+/* Read n words starting at position p into buffer */
+rfsz_t rf_memory_read_range(rfvm_t *vm, rfp_t p, rfword_t *buf, rfsz_t n, struct rfth_tlb *tlb) {
   int pid;
   unsigned int off;
-  rfword_t *page;
+  rfsz_t i, chunk;
+  rfpage_t *page;
+
+  for (i=0; i<n; i+=chunk) {
+    rf_memory_get_pid_and_offset(p+i, vm->page_shift, &pid, &off);
+    chunk = MIN(n-i, vm->page_size-off);
+    page = rf_memory_lookup_page(vm, pid, tlb);
+    memcpy(buf+i, page->data+off, sizeof(rfword_t)*chunk);
+  }
 
-  rf_memory_get_pid_and_offset(p, &pid, &off);
-  page = rf_memory_lookup_page(vm, pid, page_cache);
-  page[off] = data;
+  return n;
 }
 
 
-/* Utility function to load custom data into memory
- * TODO use memcpy
- */
-rfsz_t rf_load_data(rfvm_t *vm, rfp_t p, const rfword_t *data, rfsz_t n) {
-  rfp_t i;
+/* Write n words from buffer to memory starting at position p */
+rfsz_t rf_memory_write_range(rfvm_t *vm, rfp_t p, const rfword_t *data, rfsz_t n, struct rfth_tlb *tlb) {
+  int pid;
+  unsigned int off;
+  rfsz_t i, chunk;
+  rfpage_t *page;
+
+  for (i=0; i<n; i+=chunk) {
+    rf_memory_get_pid_and_offset(p+i, vm->page_shift, &pid, &off);
+    chunk = MIN(n-i, vm->page_size-off);
+    page = rf_memory_lookup_page_for_write(vm, pid, tlb);
+    rf_page_summary_update(vm, page, off, off+chunk-1, -1);
+    memcpy(page->data+off, data+i, sizeof(rfword_t)*chunk);
+    rf_page_summary_update(vm, page, off, off+chunk-1, 1);
+    page->summary.num_writes += chunk;
+    page->dirty = TRUE;
+    if (vm->conf.provenance) {
+      rf_provenance_write_range(vm, page, off, off+chunk-1, vm->writer);
+    }
 
-  for (i=0; i<n; i++) {
-    rf_memory_write(vm, p+i, data[i], NULL);
+    if (page->traces!=NULL) {
+      rf_trace_invalidate(vm, page, p+i, p+i+chunk-1);
+    }
   }
 
-  return i;
+  return n;
+}
+
+
+/* Utility function to load custom data into memory */
+rfsz_t rf_load_data(rfvm_t *vm, rfp_t p, const rfword_t *data, rfsz_t n) {
+  return rf_memory_write_range(vm, p, data, n, NULL);
 }
 
 
 unsigned int rf_get_num_threads(rfvm_t *vm) {
-  return vm->threads->len;
+  return vm->threads->len-vm->reaper.num_dead;
 }
 
 
@@ -452,42 +1541,212 @@ rfth_t *rf_get_thread(rfvm_t *vm, unsigned int i) {
 
 
 unsigned int rf_get_memory_usage(rfvm_t *vm) {
-  return g_tree_nnodes(vm->memory)*RFMEM_PAGE_SIZE;
+  return (g_tree_nnodes(vm->memory)-vm->tier.num_packed)*vm->page_size+vm->tier.packed_size;
 }
 
-int rf_load_program(rfvm_t *vm, const char *filename, rfp_t p) {
+
+/* TLB hits & misses of all threads (including removed ones) */
+void rf_get_tlb_stats(rfvm_t *vm, unsigned long *hits, unsigned long *misses) {
+  unsigned int i;
+  rfth_t *thread;
+
+  *hits = vm->tlb_hits;
+  *misses = vm->tlb_misses;
+
+  for (i=0; i<vm->threads->len; i++) {
+    thread = g_ptr_array_index(vm->threads, i);
+    *hits += thread->tlb.hits;
+    *misses += thread->tlb.misses;
+  }
+}
+
+/* Compile brainfuck source file to program image */
+rfimg_t *rf_image_compile(const char *filename) {
   FILE *fd;
-  rfword_t c;
   char line[1024];
   unsigned int i;
-  rfp_t p0 = p;
+  rfimg_t *img;
+  rfsz_t size = 1024;
 
   fd = fopen(filename, "rt");
   if (fd==NULL) {
-    return -1;
+    return NULL;
   }
 
+  img = (rfimg_t*)g_malloc(sizeof(rfimg_t));
+  img->code = (rfword_t*)g_malloc(sizeof(rfword_t)*size);
+  img->length = 0;
+
   while (fgets(line, 1024, fd)!=NULL) {
+    /* a line never yields more words than characters */
+    if (img->length+sizeof(line)>size) {
+      size *= 2;
+      img->code = (rfword_t*)g_realloc(img->code, sizeof(rfword_t)*size);
+    }
+
     /* read until string end, line end or comment start */
     for (i=0; line[i]!=0 && line[i]!=';' && line[i]!='\n'; i++) {
       if (line[i]=='\\' && line[i+1]=='x') {
         /* escaped character \x## */
-        c = strtoul(line+i+2, NULL, 16);
-        rf_memory_write(vm, p, c, NULL);
+        img->code[img->length++] = strtoul(line+i+2, NULL, 16);
         i += 3;
-        p++;
       }
       else if (line[i]!=' ') {
-        /* write character to memory */
-        rf_memory_write(vm, p, line[i], NULL);
-        p++;
+        /* copy character */
+        img->code[img->length++] = line[i];
       }
     }
   }
 
   fclose(fd);
 
-  return (int)p-p0;
+  return img;
+}
+
+
+/* Load program image. Falls back to compiling the file, if it isn't an image */
+rfimg_t *rf_image_load(const char *filename) {
+  FILE *fd;
+  char magic[RFIMG_MAGIC_LENGTH+1];
+  guint8 wordsize;
+  guint32 length;
+  rfimg_t *img;
+
+  /* open file */
+  fd = fopen(filename, "rb");
+  if (fd==NULL) {
+    return NULL;
+  }
+
+  /* check magic */
+  if (fgets(magic, sizeof(magic), fd)==NULL || strcmp(magic, RFIMG_MAGIC)!=0) {
+    fclose(fd);
+    return rf_image_compile(filename);
+  }
+
+  /* read word size & code length */
+  if (fread(&wordsize, sizeof(wordsize), 1, fd)!=1 || wordsize!=sizeof(rfword_t)
+      || fread(&length, sizeof(length), 1, fd)!=1) {
+    fclose(fd);
+    return NULL;
+  }
+
+  /* read code */
+  img = (rfimg_t*)g_malloc(sizeof(rfimg_t));
+  img->code = (rfword_t*)g_malloc(sizeof(rfword_t)*MAX(length, 1));
+  img->length = fread(img->code, sizeof(rfword_t), length, fd);
+
+  fclose(fd);
+
+  if (img->length!=length) {
+    rf_image_free(img);
+    return NULL;
+  }
+
+  return img;
+}
+
+
+/* Store program image */
+gboolean rf_image_store(rfimg_t *img, const char *filename) {
+  FILE *fd;
+  guint8 wordsize = (guint8)sizeof(rfword_t);
+  guint32 length = (guint32)img->length;
+  gboolean ok;
+
+  fd = fopen(filename, "wb");
+  if (fd==NULL) {
+    return FALSE;
+  }
+
+  fputs(RFIMG_MAGIC, fd);
+  fwrite(&wordsize, sizeof(wordsize), 1, fd);
+  fwrite(&length, sizeof(length), 1, fd);
+  ok = fwrite(img->code, sizeof(rfword_t), img->length, fd)==img->length;
+
+  return fclose(fd)==0 && ok;
+}
+
+
+/* Free program image */
+void rf_image_free(rfimg_t *img) {
+  g_free(img->code);
+  g_free(img);
+}
+
+
+/* Load program from brainfuck source file into memory */
+int rf_load_program(rfvm_t *vm, const char *filename, rfp_t p) {
+  rfimg_t *img;
+  int length;
+
+  img = rf_image_compile(filename);
+  if (img==NULL) {
+    return -1;
+  }
+
+  length = (int)rf_load_data(vm, p, img->code, img->length);
+  rf_image_free(img);
+
+  return length;
+}
+
+
+/* Comparator: orders seeds by position */
+struct rf_seed {
+  rfp_t p;
+  rfimg_t *img;
+};
+static int rf_seed_compare(const void *a, const void *b) {
+  rfp_t pa = ((const struct rf_seed*)a)->p;
+  rfp_t pb = ((const struct rf_seed*)b)->p;
+
+  return (pa>pb)-(pa<pb);
+}
+
+
+/* Place n copies of the images (round robin) at random positions (gauss
+ * distribution around mu) and create a thread for each copy.
+ * Returns number of created threads.
+ */
+unsigned int rf_seed_population(rfvm_t *vm, rfimg_t **images, unsigned int num_images, unsigned int n, rfp_t mu, rfsz_t sigma) {
+  struct rf_seed *seeds;
+  struct rfth_tlb tlb;
+  rfth_t *thread;
+  unsigned int i, num_threads = 0;
+
+  if (num_images==0 || n==0) {
+    return 0;
+  }
+
+  /* draw all positions first, then sort them, so that copies on the same
+   * page are written one after another
+   */
+  seeds = g_new(struct rf_seed, n);
+  for (i=0; i<n; i++) {
+    seeds[i].p = rf_rand_p(vm, mu, sigma);
+    seeds[i].img = images[i%num_images];
+  }
+  qsort(seeds, n, sizeof(struct rf_seed), rf_seed_compare);
+
+  /* write code */
+  memset(&tlb, 0, sizeof(tlb));
+  for (i=0; i<n; i++) {
+    rf_memory_write_range(vm, seeds[i].p, seeds[i].img->code, seeds[i].img->length, &tlb);
+  }
+
+  /* create threads for copies that weren't overwritten */
+  for (i=0; i<n && (vm->conf.max_threads==0 || rf_get_num_threads(vm)<vm->conf.max_threads); i++) {
+    if (rf_memory_read(vm, seeds[i].p, &tlb)==0) {
+      thread = rf_thread_new(vm, seeds[i].p, seeds[i].p, seeds[i].p);
+      rf_thread_born(vm, thread, NULL);
+      num_threads++;
+    }
+  }
+
+  g_free(seeds);
+
+  return num_threads;
 }
 
 
@@ -498,14 +1757,18 @@ static void rf_thread_store_pstackitem(void *data, void *userdata) {
   fwrite(&p, sizeof(rfp_t), 1, fd);
 }
 
+struct rf_memory_store_page_iterargs {
+  FILE *fd;
+  unsigned int page_size;
+};
 static gboolean rf_memory_store_page(void *key, void *value, void *userdata) {
-  FILE *fd = (FILE*)userdata;
+  struct rf_memory_store_page_iterargs *args = (struct rf_memory_store_page_iterargs*)userdata;
   gint32 pid = (gint32)GPOINTER_TO_INT(key);
-  rfword_t *page = (rfword_t*)value;
+  rfpage_t *page = (rfpage_t*)value;
 
   /* write page ID & page */
-  fwrite(&pid, sizeof(pid), 1, fd);
-  fwrite(page, sizeof(rfword_t), RFMEM_PAGE_SIZE, fd);
+  fwrite(&pid, sizeof(pid), 1, args->fd);
+  fwrite(page->data, sizeof(rfword_t), args->page_size, args->fd);
 
   return FALSE;
 }
@@ -513,19 +1776,22 @@ static gboolean rf_memory_store_page(void *key, void *value, void *userdata) {
 /* store VM state */
 gboolean rf_vm_store(rfvm_t *vm, const char *filename) {
   FILE *fd;
-  guint32 pagesize = (guint64)RFMEM_PAGE_SIZE;
+  struct rf_memory_store_page_iterargs args;
+  guint32 pagesize = (guint32)vm->page_size;
   guint8 wordsize = (guint8)sizeof(rfword_t);
   guint32 num_pages = (guint32)g_tree_nnodes(vm->memory);
   guint32 clock;
   guint16 num;
   rfth_t *thread;
   unsigned int i;
+  gboolean stored;
 
-  /* open file */
+  /* open file, pages are written in big batches */
   fd = fopen(filename, "wb");
   if (fd==NULL) {
     return FALSE;
   }
+  setvbuf(fd, NULL, _IOFBF, RFMEM_DUMP_BUFFER);
 
   /* file magic */
   fputs(RFMEM_DUMP_MAGIC, fd);
@@ -559,13 +1825,15 @@ gboolean rf_vm_store(rfvm_t *vm, const char *filename) {
     g_slist_foreach(thread->pstack, rf_thread_store_pstackitem, fd);
   }
 
-  /* store memory */
-  g_tree_foreach(vm->memory, rf_memory_store_page, fd);
+  /* store memory (packed pages are unpacked) */
+  rf_tier_flush(vm);
+  args.fd = fd;
+  args.page_size = vm->page_size;
+  g_tree_foreach(vm->memory, rf_memory_store_page, &args);
   
-  /* close file */
-  fclose(fd);
-
-  return TRUE;
+  /* close file (failed writes are reported by then) */
+  stored = !ferror(fd);
+  return fclose(fd)==0 && stored;
 }
 
 /* load VM state
@@ -574,7 +1842,7 @@ gboolean rf_vm_load(rfvm_t *vm, const char *filename) {
   FILE *fd;
   guint32 pagesize, num_pages, pid;
   guint8 wordsize;
-  rfword_t *page;
+  rfpage_t *page;
   unsigned int i;
   char magic[RFMEM_DUMP_MAGIC_LENGTH+1];
 
@@ -597,22 +1865,41 @@ gboolean rf_vm_load(rfvm_t *vm, const char *filename) {
   fread(&num_pages, sizeof(num_pages), 1, fd);
 
   /* check page size & word size */
-  if (pagesize!=RFMEM_PAGE_SIZE || wordsize!=sizeof(rfword_t)) {
+  if (pagesize!=vm->page_size || wordsize!=sizeof(rfword_t)) {
     fclose(fd);
     return FALSE;
   }
 
+  /* pages are replaced, so drop traces, tiers, virtual pages and cached page
+   * lookups
+   */
+  rf_trace_flush(vm);
+  rf_tier_flush(vm);
+  rf_memory_drop_virtual(vm);
+
   /* read pages */
   for (i=0; i<num_pages; i++) {
     /* read page ID */
     fread(&pid, sizeof(pid), 1, fd);
 
-    /* read page */
-    page = (rfword_t*)g_malloc(sizeof(rfword_t)*RFMEM_PAGE_SIZE);
-    fread(page, sizeof(rfword_t), RFMEM_PAGE_SIZE, fd);
+    /* read page (pages of the window are overwritten in place) */
+    if (rf_window_has_page(vm, (int)pid)) {
+      page = rf_memory_lookup_page_for_write(vm, (int)pid, NULL);
+      rf_provenance_free(page);
+      memset(&page->shadow, 0, sizeof(page->shadow));
+      memset(&page->summary, 0, sizeof(page->summary));
+    }
+    else {
+      page = rf_page_new(vm);
+    }
+    fread(page->data, sizeof(rfword_t), vm->page_size, fd);
+    page->dirty = TRUE;
+    rf_page_summary_update(vm, page, 0, vm->page_size-1, 1);
 
     /* insert page into memory tree */
-    g_tree_insert(vm->memory, GINT_TO_POINTER(pid), page);
+    if (!page->window) {
+      g_tree_insert(vm->memory, GINT_TO_POINTER(pid), page);
+    }
   }
 
   /* close file */
@@ -0,0 +1,97 @@
+/* stack.c - stack operations
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+
+#include "replifuck.h"
+#include "page.h"
+#include "stack.h"
+
+
+
+/* Run pushes or pops at IP at once, after the interpreter ran one. Runs at
+ * most n instructions and stops before the next scheduled mutation.
+ * Returns number of executed instructions (0 if the interpreter must run the
+ * next instruction).
+ */
+unsigned int rf_stack_run(rfvm_t *vm, rfth_t *thread, unsigned int n) {
+  const unsigned int page_shift = vm->page_shift;
+  guint64 limit;
+  unsigned int i, k;
+  rfword_t instr;
+
+  /* instructions until the next mutation or the thread's death */
+  limit = MIN((guint64)n, MIN(vm->mutations.next_instr, MIN(vm->mutations.next_mem, vm->mutations.next_kill))-1);
+  if (vm->conf.max_cycles>0) {
+    limit = MIN(limit, thread->clock<vm->conf.max_cycles ? vm->conf.max_cycles-thread->clock-1 : 0);
+  }
+  if (limit<2) {
+    return 0;
+  }
+
+  /* length of the run */
+  instr = rf_memory_read_fast(vm, thread->ip, &thread->tlb, page_shift);
+  if (instr!='^' && instr!='V') {
+    return 0;
+  }
+  for (k=1; k<limit && rf_memory_read_fast(vm, thread->ip+k, &thread->tlb, page_shift)==instr; k++);
+  if (k<2) {
+    return 0;
+  }
+
+  if (instr=='^') {
+    /* pushes must not overwrite the run itself */
+    if (thread->sp-(rfp_t)k<=thread->ip+(rfp_t)k-1 && thread->sp-1>=thread->ip) {
+      return 0;
+    }
+
+    for (i=0; i<k; i++) {
+      thread->sp--;
+      vm->stack.shared += rf_memory_move_fast(vm, thread->dp, thread->sp, &thread->tlb, page_shift);
+    }
+    vm->stack.pushes += k;
+    rf_stack_push_bounds(vm, thread);
+  }
+  else {
+    /* pops must not overwrite the run itself */
+    if (thread->dp>=thread->ip && thread->dp<=thread->ip+(rfp_t)k-1) {
+      return 0;
+    }
+
+    for (i=0; i<k; i++) {
+      vm->stack.shared += rf_memory_move_fast(vm, thread->sp, thread->dp, &thread->tlb, page_shift);
+      thread->sp++;
+      rf_stack_pop_bounds(vm, thread);
+    }
+    vm->stack.pops += k;
+  }
+
+  thread->ip += k;
+  thread->clock += k;
+  vm->mutations.next_instr -= k;
+  vm->mutations.next_mem -= k;
+  vm->mutations.next_kill -= k;
+  vm->stack.num_runs++;
+  vm->stack.run_instructions += k;
+
+  return k;
+}
@@ -0,0 +1,279 @@
+/* sweep.c - parameter sweeps in worker processes
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "replifuck.h"
+#include "monitor.h"
+#include "sweep.h"
+
+
+/* Append comma separated rates to array. Returns FALSE if one is invalid */
+gboolean rf_sweep_parse_rates(GArray *rates, const char *list) {
+  gchar **items, *end;
+  double rate;
+  unsigned int i;
+  gboolean valid = TRUE;
+
+  items = g_strsplit(list, ",", 0);
+  for (i=0; valid && items[i]!=NULL; i++) {
+    rate = g_ascii_strtod(items[i], &end);
+    if (end==items[i] || *end!='\0' || rate<0.0) {
+      valid = FALSE;
+    }
+    else {
+      g_array_append_val(rates, rate);
+    }
+  }
+  g_strfreev(items);
+
+  return valid;
+}
+
+
+/* Run VM with the parameters of result (in worker process) */
+static void rf_sweep_worker(const rfconf_t *conf, struct rfsweep_result *result, unsigned int cycles, rfimg_t **images, unsigned int num_images) {
+  rfconf_t run_conf;
+  rfvm_t *vm;
+  struct rfmonitor *monitor = NULL;
+  gint64 start;
+
+  memcpy(&run_conf, conf, sizeof(rfconf_t));
+  run_conf.seed = result->seed;
+  run_conf.rate_instr = result->rate_instr;
+  run_conf.rate_mem = result->rate_mem;
+  run_conf.rate_kill = result->rate_kill;
+
+  start = g_get_monotonic_time();
+
+  vm = rf_vm_new_full(&run_conf);
+  if (vm==NULL) {
+    return;
+  }
+  rf_seed_population(vm, images, num_images, conf->initial_population, 0, conf->initial_spread);
+
+  if (conf->monitor_window>0) {
+    monitor = rf_monitor_new(vm);
+  }
+
+  result->max_threads = rf_get_num_threads(vm);
+  while (vm->clock<cycles && rf_get_num_threads(vm)>0) {
+    rf_vm_cycle(vm);
+    result->max_threads = MAX(result->max_threads, rf_get_num_threads(vm));
+    if (monitor!=NULL && rf_monitor_update(monitor, vm)) {
+      break;
+    }
+  }
+
+  result->clock = vm->clock;
+  if (monitor!=NULL) {
+    result->state = monitor->state;
+    rf_monitor_free(monitor);
+  }
+  else {
+    result->state = rf_get_num_threads(vm)>0 ? RFMONITOR_RUNNING : RFMONITOR_EXTINCT;
+  }
+  result->threads = rf_get_num_threads(vm);
+  result->pages = g_tree_nnodes(vm->memory);
+  result->births = vm->last_id;
+  result->instructions = vm->instructions;
+  result->seconds = (g_get_monotonic_time()-start)/1e6;
+  result->failed = FALSE;
+
+  rf_vm_free(vm);
+}
+
+
+/* Append runs for all combinations of rates & seeds (seeds vary fastest) */
+static GArray *rf_sweep_plan(const rfconf_t *conf, const struct rfsweep *sweep) {
+  GArray *results;
+  struct rfsweep_result run;
+  unsigned int i, j, k, s;
+
+#define RF_SWEEP_RATE(rates, i, rate) ((rates)->len>0 ? g_array_index(rates, double, i) : (rate))
+
+  results = g_array_new(FALSE, FALSE, sizeof(struct rfsweep_result));
+  memset(&run, 0, sizeof(run));
+  run.failed = TRUE;
+
+  for (i=0; i<MAX(sweep->rates_instr->len, 1); i++) {
+    for (j=0; j<MAX(sweep->rates_mem->len, 1); j++) {
+      for (k=0; k<MAX(sweep->rates_kill->len, 1); k++) {
+        for (s=0; s<sweep->num_seeds; s++) {
+          run.seed = sweep->seed+s;
+          run.rate_instr = RF_SWEEP_RATE(sweep->rates_instr, i, conf->rate_instr);
+          run.rate_mem = RF_SWEEP_RATE(sweep->rates_mem, j, conf->rate_mem);
+          run.rate_kill = RF_SWEEP_RATE(sweep->rates_kill, k, conf->rate_kill);
+          g_array_append_val(results, run);
+        }
+      }
+    }
+  }
+
+#undef RF_SWEEP_RATE
+
+  return results;
+}
+
+
+/* Run sweep, forking a worker for each run. Returns results of all runs
+ * (runs of failed workers are marked)
+ */
+GArray *rf_sweep_run(const rfconf_t *conf, const struct rfsweep *sweep, rfimg_t **images, unsigned int num_images) {
+  GArray *results;
+  struct rfsweep_result *run, result;
+  unsigned int i, next, running = 0, jobs;
+  pid_t *pids, pid;
+  int *fds, fd[2], status;
+
+  results = rf_sweep_plan(conf, sweep);
+
+  jobs = sweep->jobs;
+  if (jobs==0) {
+    jobs = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+  }
+
+  pids = g_new0(pid_t, results->len);
+  fds = g_new(int, results->len);
+
+  /* workers mustn't write buffered output again */
+  fflush(NULL);
+
+  for (next=0; next<results->len || running>0;) {
+    if (next<results->len && running<jobs) {
+      /* start worker */
+      run = &g_array_index(results, struct rfsweep_result, next);
+      if (pipe(fd)<0) {
+        next++;
+        continue;
+      }
+
+      pid = fork();
+      if (pid==0) {
+        close(fd[0]);
+        rf_sweep_worker(conf, run, sweep->cycles, images, num_images);
+        if (write(fd[1], run, sizeof(*run))!=sizeof(*run)) {
+          _exit(1);
+        }
+        _exit(0);
+      }
+
+      close(fd[1]);
+      if (pid<0) {
+        close(fd[0]);
+      }
+      else {
+        pids[next] = pid;
+        fds[next] = fd[0];
+        running++;
+      }
+      next++;
+    }
+    else {
+      /* wait for a worker, results fit into the pipe, so it's done */
+      pid = waitpid(-1, &status, 0);
+      if (pid<0) {
+        if (errno==EINTR) {
+          continue;
+        }
+        break;
+      }
+
+      for (i=0; i<next; i++) {
+        if (pids[i]==pid) {
+          if (read(fds[i], &result, sizeof(result))==sizeof(result)) {
+            g_array_index(results, struct rfsweep_result, i) = result;
+          }
+          close(fds[i]);
+          pids[i] = 0;
+          running--;
+          break;
+        }
+      }
+    }
+  }
+
+  g_free(pids);
+  g_free(fds);
+
+  return results;
+}
+
+
+/* Print table of runs & table aggregated over seeds */
+void rf_sweep_print(GArray *results, FILE *fd) {
+  struct rfsweep_result *run, *first;
+  unsigned int i, j, num_runs, num_states[RFMONITOR_NUM_STATES];
+  double threads, max_threads, births, instructions, seconds;
+
+  fprintf(fd, "# seed rate_instr rate_mem rate_kill cycles threads max_threads pages births instructions seconds instructions/s state\n");
+  for (i=0; i<results->len; i++) {
+    run = &g_array_index(results, struct rfsweep_result, i);
+    if (run->failed) {
+      fprintf(fd, "%lu %g %g %g failed\n", run->seed, run->rate_instr, run->rate_mem, run->rate_kill);
+    }
+    else {
+      fprintf(fd, "%lu %g %g %g %u %u %u %u %u %" G_GUINT64_FORMAT " %.3f %.0f %s\n",
+              run->seed, run->rate_instr, run->rate_mem, run->rate_kill, run->clock,
+              run->threads, run->max_threads, run->pages, run->births, run->instructions,
+              run->seconds, run->seconds>0.0 ? run->instructions/run->seconds : 0.0,
+              rf_monitor_state_name(run->state));
+    }
+  }
+
+  /* runs with the same rates are consecutive */
+  fprintf(fd, "\n# rate_instr rate_mem rate_kill runs failed extinct plateau fixation mean_threads mean_max_threads mean_births instructions/s\n");
+  for (i=0; i<results->len; i=j) {
+    first = &g_array_index(results, struct rfsweep_result, i);
+    num_runs = 0;
+    memset(num_states, 0, sizeof(num_states));
+    threads = max_threads = births = instructions = seconds = 0.0;
+
+    for (j=i; j<results->len; j++) {
+      run = &g_array_index(results, struct rfsweep_result, j);
+      if (run->rate_instr!=first->rate_instr || run->rate_mem!=first->rate_mem || run->rate_kill!=first->rate_kill) {
+        break;
+      }
+      if (!run->failed) {
+        num_runs++;
+        num_states[run->state]++;
+        threads += run->threads;
+        max_threads += run->max_threads;
+        births += run->births;
+        instructions += run->instructions;
+        seconds += run->seconds;
+      }
+    }
+
+    fprintf(fd, "%g %g %g %u %u %u %u %u %.1f %.1f %.1f %.0f\n", first->rate_instr, first->rate_mem, first->rate_kill,
+            num_runs, j-i-num_runs, num_states[RFMONITOR_EXTINCT], num_states[RFMONITOR_PLATEAU],
+            num_states[RFMONITOR_FIXATION], num_runs>0 ? threads/num_runs : 0.0,
+            num_runs>0 ? max_threads/num_runs : 0.0, num_runs>0 ? births/num_runs : 0.0,
+            seconds>0.0 ? instructions/seconds : 0.0);
+  }
+}
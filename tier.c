@@ -0,0 +1,373 @@
+/* tier.c - hot & cold tiers of pages
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "replifuck.h"
+#include "page.h"
+#include "trace.h"
+#include "tier.h"
+
+
+
+/* Create arena for hot pages. Returns FALSE if it can't be mapped (pages are
+ * packed anyway then).
+ */
+gboolean rf_tier_init(rfvm_t *vm) {
+  struct rfarena *arena;
+  void *data;
+  size_t size;
+  unsigned int i;
+
+  vm->tier.arena = NULL;
+  if (vm->conf.tier_hot==0) {
+    return TRUE;
+  }
+
+  size = sizeof(rfword_t)*vm->page_size*vm->conf.tier_hot;
+  data = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (data==MAP_FAILED) {
+    return FALSE;
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(data, size, MADV_HUGEPAGE);
+#endif
+
+  arena = g_new0(struct rfarena, 1);
+  arena->data = (rfword_t*)data;
+  arena->size = size;
+  arena->num_slots = vm->conf.tier_hot;
+  arena->free = g_new(unsigned int, arena->num_slots);
+  for (i=0; i<arena->num_slots; i++) {
+    arena->free[i] = arena->num_slots-1-i;
+  }
+  arena->num_free = arena->num_slots;
+
+  vm->tier.arena = arena;
+
+  return TRUE;
+}
+
+
+/* Free arena (after all pages were freed) */
+void rf_tier_free(rfvm_t *vm) {
+  struct rfarena *arena = vm->tier.arena;
+
+  if (arena!=NULL) {
+    munmap(arena->data, arena->size);
+    g_free(arena->free);
+    g_free(arena);
+    vm->tier.arena = NULL;
+  }
+}
+
+
+/* Give slot of a hot page back to its arena (the page is freed) */
+void rf_tier_release(rfpage_t *page) {
+  page->arena->free[page->arena->num_free++] = page->slot;
+  page->arena = NULL;
+}
+
+
+/* Number of pages in the arena */
+unsigned int rf_tier_num_hot(rfvm_t *vm) {
+  return vm->tier.arena!=NULL ? vm->tier.arena->num_slots-vm->tier.arena->num_free : 0;
+}
+
+
+/* Move page into a free slot of the arena */
+static void rf_tier_promote(rfvm_t *vm, rfpage_t *page) {
+  struct rfarena *arena = vm->tier.arena;
+
+  page->slot = arena->free[--arena->num_free];
+  page->arena = arena;
+  memcpy(arena->data+(rfsz_t)page->slot*vm->page_size, page->data, sizeof(rfword_t)*vm->page_size);
+  page->data = arena->data+(rfsz_t)page->slot*vm->page_size;
+  vm->tier.num_promoted++;
+}
+
+/* Move page from the arena back to the words following it */
+static void rf_tier_demote(rfvm_t *vm, rfpage_t *page) {
+  memcpy(page+1, page->data, sizeof(rfword_t)*vm->page_size);
+  page->data = (rfword_t*)(page+1);
+  rf_tier_release(page);
+  vm->tier.num_demoted++;
+}
+
+
+/* Pack page (replacing it in the memory tree). Returns FALSE if it isn't
+ * worth it (packed words would take more than half of the page).
+ * NOTE: buf and out must have room for a page.
+ */
+static gboolean rf_tier_pack(rfvm_t *vm, int pid, rfpage_t *page, rfword_t *buf, guint8 *out) {
+  rfpage_t *packed;
+  guint32 zeros, length;
+  unsigned int i, first, run, size = 0, n = vm->page_size;
+  size_t max_size = sizeof(rfword_t)*n/2;
+
+  /* words that were never written become 0 */
+  rf_rand_page_words(vm->conf.seed, pid, buf, n);
+  for (i=0; i<n; i++) {
+    buf[i] ^= page->data[i];
+  }
+
+  /* runs of 0s, each followed by words up to the next long run of 0s */
+  for (i=0; i<n;) {
+    for (first=i; i<n && buf[i]==0; i++);
+    zeros = i-first;
+
+    for (first=i; i<n; i++) {
+      if (buf[i]==0) {
+        for (run=i; run<n && buf[run]==0; run++);
+        if (run-i>=RFTIER_MIN_RUN || run==n) {
+          break;
+        }
+        i = run-1;
+      }
+    }
+    length = i-first;
+
+    if (size+2*sizeof(guint32)+sizeof(rfword_t)*length>max_size) {
+      return FALSE;
+    }
+    memcpy(out+size, &zeros, sizeof(guint32));
+    memcpy(out+size+sizeof(guint32), &length, sizeof(guint32));
+    memcpy(out+size+2*sizeof(guint32), buf+first, sizeof(rfword_t)*length);
+    size += 2*sizeof(guint32)+sizeof(rfword_t)*length;
+  }
+
+  /* page keeps its summary & writers, but not its words */
+  rf_trace_invalidate_page(vm, page);
+  packed = (rfpage_t*)g_memdup(page, sizeof(rfpage_t));
+  packed->data = NULL;
+  packed->packed = (guint8*)g_memdup(out, size);
+  packed->packed_size = size;
+
+  g_tree_steal(vm->memory, GINT_TO_POINTER(pid));
+  g_free(page);
+  g_tree_insert(vm->memory, GINT_TO_POINTER(pid), packed);
+
+  vm->tier.num_packed++;
+  vm->tier.packed_size += size;
+
+  return TRUE;
+}
+
+
+/* Get words of packed page */
+void rf_tier_read(rfvm_t *vm, int pid, const rfpage_t *page, rfword_t *data) {
+  guint32 zeros, length;
+  unsigned int i = 0, j, pos = 0;
+  const rfword_t *words;
+
+  rf_rand_page_words(vm->conf.seed, pid, data, vm->page_size);
+  while (pos<page->packed_size) {
+    memcpy(&zeros, page->packed+pos, sizeof(guint32));
+    memcpy(&length, page->packed+pos+sizeof(guint32), sizeof(guint32));
+    words = (const rfword_t*)(page->packed+pos+2*sizeof(guint32));
+    i += zeros;
+    for (j=0; j<length; j++) {
+      data[i+j] ^= words[j];
+    }
+    i += length;
+    pos += 2*sizeof(guint32)+sizeof(rfword_t)*length;
+  }
+}
+
+
+/* Unpack page (replacing it in the memory tree). Returns the unpacked page. */
+rfpage_t *rf_tier_unpack(rfvm_t *vm, int pid, rfpage_t *page) {
+  rfpage_t *copy;
+
+  copy = (rfpage_t*)g_malloc(sizeof(rfpage_t)+sizeof(rfword_t)*vm->page_size);
+  memcpy(copy, page, sizeof(rfpage_t));
+  copy->data = (rfword_t*)(copy+1);
+  copy->packed = NULL;
+  copy->packed_size = 0;
+  copy->cold = 0;
+  rf_tier_read(vm, pid, page, copy->data);
+
+  vm->tier.num_packed--;
+  vm->tier.packed_size -= page->packed_size;
+  vm->tier.num_unpacked++;
+
+  g_tree_steal(vm->memory, GINT_TO_POINTER(pid));
+  g_free(page->packed);
+  g_free(page);
+  g_tree_insert(vm->memory, GINT_TO_POINTER(pid), copy);
+
+  return copy;
+}
+
+
+/* Pages may only be moved or packed if nobody else has their words */
+static inline gboolean rf_tier_movable(rfpage_t *page) {
+  return g_atomic_int_get(&page->refs)==1 && page->export==NULL && !page->window;
+}
+
+
+/* Iterator: demotes hot pages & collects packed pages */
+static gboolean rf_tier_flush_iter(void *key, void *value, void *userdata) {
+  rfvm_t *vm = (rfvm_t*)((void**)userdata)[0];
+  GArray *pids = (GArray*)((void**)userdata)[1];
+  rfpage_t *page = (rfpage_t*)value;
+  int pid = GPOINTER_TO_INT(key);
+
+  if (page->arena!=NULL) {
+    rf_tier_demote(vm, page);
+  }
+  else if (page->packed!=NULL) {
+    g_array_append_val(pids, pid);
+  }
+
+  return FALSE;
+}
+
+/* Put all pages back into their plain form (before pages are shared with a
+ * clone or all their words are read)
+ */
+void rf_tier_flush(rfvm_t *vm) {
+  GArray *pids;
+  void *args[2];
+  unsigned int i;
+  int pid;
+
+  if (rf_tier_num_hot(vm)==0 && vm->tier.num_packed==0) {
+    return;
+  }
+
+  pids = g_array_new(FALSE, FALSE, sizeof(int));
+  args[0] = vm;
+  args[1] = pids;
+  g_tree_foreach(vm->memory, rf_tier_flush_iter, args);
+
+  for (i=0; i<pids->len; i++) {
+    pid = g_array_index(pids, int, i);
+    rf_tier_unpack(vm, pid, g_tree_lookup(vm->memory, GINT_TO_POINTER(pid)));
+  }
+  g_array_free(pids, TRUE);
+
+  rf_memory_invalidate(vm);
+}
+
+
+/* Iterator: cools pages down & counts their writes since the last pass */
+static gboolean rf_tier_heat_iter(void *key, void *value, void *userdata) {
+  rfpage_t *page = (rfpage_t*)value;
+  unsigned int writes;
+
+  /* writes are counted on, but don't let the difference wrap if the counter
+   * is smaller than at the last pass
+   */
+  writes = page->summary.num_writes>=page->tier_writes ? page->summary.num_writes-page->tier_writes : page->summary.num_writes;
+  page->heat = page->heat/2+MIN(writes, RFTIER_MAX_WRITES);
+  page->tier_writes = page->summary.num_writes;
+
+  return FALSE;
+}
+
+/* Iterator: moves pages between arena & memory, collects pages to pack */
+static gboolean rf_tier_sort_iter(void *key, void *value, void *userdata) {
+  rfvm_t *vm = (rfvm_t*)((void**)userdata)[0];
+  GArray *pids = (GArray*)((void**)userdata)[1];
+  rfpage_t *page = (rfpage_t*)value;
+  int pid = GPOINTER_TO_INT(key);
+
+  if (page->packed!=NULL || !rf_tier_movable(page)) {
+    return FALSE;
+  }
+
+  page->cold = page->heat>0 ? 0 : page->cold+1;
+
+  if (page->arena!=NULL) {
+    if (page->heat<RFTIER_HOT/2) {
+      rf_tier_demote(vm, page);
+    }
+  }
+  else if (page->heat>=RFTIER_HOT) {
+    if (vm->tier.arena!=NULL && vm->tier.arena->num_free>0) {
+      rf_tier_promote(vm, page);
+    }
+  }
+  else if (page->cold>=RFTIER_COLD && page->dirty) {
+    g_array_append_val(pids, pid);
+  }
+
+  return FALSE;
+}
+
+/* Sort pages into tiers (called every tier_interval cycles) */
+void rf_tier_update(rfvm_t *vm) {
+  GArray *pids;
+  void *args[2];
+  rfword_t *buf;
+  guint8 *out;
+  rfpage_t *page;
+  rfth_t *thread;
+  rfp_t p[3];
+  unsigned int i, j, off;
+  int pid;
+
+  g_tree_foreach(vm->memory, rf_tier_heat_iter, NULL);
+
+  /* pages under threads */
+  for (i=0; i<vm->threads->len; i++) {
+    thread = g_ptr_array_index(vm->threads, i);
+    p[0] = thread->ip;
+    p[1] = thread->dp;
+    p[2] = thread->sp;
+    for (j=0; j<3; j++) {
+      rf_memory_get_pid_and_offset(p[j], vm->page_shift, &pid, &off);
+      page = g_tree_lookup(vm->memory, GINT_TO_POINTER(pid));
+      if (page!=NULL) {
+        page->heat += RFTIER_TOUCH;
+      }
+    }
+  }
+
+  pids = g_array_new(FALSE, FALSE, sizeof(int));
+  args[0] = vm;
+  args[1] = pids;
+  g_tree_foreach(vm->memory, rf_tier_sort_iter, args);
+
+  if (pids->len>0) {
+    buf = g_new(rfword_t, vm->page_size);
+    out = g_new(guint8, sizeof(rfword_t)*vm->page_size);
+    for (i=0; i<pids->len; i++) {
+      pid = g_array_index(pids, int, i);
+      page = g_tree_lookup(vm->memory, GINT_TO_POINTER(pid));
+      if (!rf_tier_pack(vm, pid, page, buf, out)) {
+        /* try again after it stayed cold again */
+        page->cold = 0;
+      }
+    }
+    g_free(buf);
+    g_free(out);
+
+    /* TLBs may have the pages that were replaced */
+    rf_memory_invalidate(vm);
+  }
+
+  g_array_free(pids, TRUE);
+}
@@ -0,0 +1,463 @@
+/* trace.c - trace cache for replifuck
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "replifuck.h"
+#include "page.h"
+#include "trace.h"
+#include "stack.h"
+#include "native.h"
+
+
+
+/* Free trace */
+static void rf_trace_free(void *data) {
+  struct rftrace *trace = (struct rftrace*)data;
+
+  if (trace->native!=NULL) {
+    rf_native_free(trace->native);
+  }
+  g_free(trace);
+}
+
+
+/* Create trace cache */
+void rf_trace_init(rfvm_t *vm) {
+  vm->trace.cache = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, rf_trace_free);
+}
+
+
+/* Add trace to (or remove it from) the pages it covers */
+static void rf_trace_link(rfvm_t *vm, struct rftrace *trace, gboolean link) {
+  int pid, last;
+  unsigned int off;
+  rfpage_t *page;
+
+  rf_memory_get_pid_and_offset(trace->start, vm->page_shift, &pid, &off);
+  rf_memory_get_pid_and_offset(trace->end, vm->page_shift, &last, &off);
+
+  for (; pid<=last; pid++) {
+    page = g_tree_lookup(vm->memory, GINT_TO_POINTER(pid));
+    if (page==NULL) {
+      continue;
+    }
+    if (link) {
+      /* pages with traces are never shared, so writers only check traces */
+      if (g_atomic_int_get(&page->refs)>1) {
+        page = rf_memory_unshare_page(vm, pid, page);
+      }
+      page->traces = g_slist_prepend(page->traces, trace);
+    }
+    else {
+      page->traces = g_slist_remove(page->traces, trace);
+    }
+  }
+}
+
+
+/* Remove trace from cache */
+static void rf_trace_drop(rfvm_t *vm, struct rftrace *trace) {
+  if (trace->state==RFTRACE_COMPILED) {
+    rf_trace_link(vm, trace, FALSE);
+    vm->trace.num_invalidated++;
+  }
+  g_hash_table_remove(vm->trace.cache, GINT_TO_POINTER(trace->start));
+}
+
+
+/* Iterator: unlinks compiled traces from their pages */
+static void rf_trace_flush_iter(void *key, void *value, void *userdata) {
+  struct rftrace *trace = (struct rftrace*)value;
+
+  if (trace->state==RFTRACE_COMPILED) {
+    rf_trace_link((rfvm_t*)userdata, trace, FALSE);
+    ((rfvm_t*)userdata)->trace.num_invalidated++;
+  }
+}
+
+/* Remove all traces */
+void rf_trace_flush(rfvm_t *vm) {
+  g_hash_table_foreach(vm->trace.cache, rf_trace_flush_iter, vm);
+  g_hash_table_remove_all(vm->trace.cache);
+}
+
+
+/* Free trace cache */
+void rf_trace_destroy(rfvm_t *vm) {
+  rf_trace_flush(vm);
+  g_hash_table_destroy(vm->trace.cache);
+}
+
+
+/* Drop traces covering words first to last of page (words were written) */
+void rf_trace_invalidate(rfvm_t *vm, rfpage_t *page, rfp_t first, rfp_t last) {
+  GSList *item, *next;
+  struct rftrace *trace;
+
+  for (item=page->traces; item!=NULL; item=next) {
+    next = item->next;
+    trace = (struct rftrace*)item->data;
+    if (trace->start<=last && trace->end>=first) {
+      rf_trace_drop(vm, trace);
+    }
+  }
+}
+
+
+/* Drop all traces covering a page (page is freed) */
+void rf_trace_invalidate_page(rfvm_t *vm, rfpage_t *page) {
+  while (page->traces!=NULL) {
+    rf_trace_drop(vm, (struct rftrace*)page->traces->data);
+  }
+}
+
+
+/* Read word without generating its page. Returns FALSE if the page isn't in
+ * memory (traces are only linked to pages in memory)
+ */
+static gboolean rf_trace_peek(rfvm_t *vm, rfp_t p, rfword_t *data) {
+  int pid;
+  unsigned int off;
+  rfpage_t *page;
+
+  rf_memory_get_pid_and_offset(p, vm->page_shift, &pid, &off);
+  page = rf_memory_peek_page(vm, pid, NULL);
+  if (page==NULL) {
+    return FALSE;
+  }
+
+  *data = page->data[off];
+  return TRUE;
+}
+
+
+/* Append operation. Returns FALSE if there are too many operations */
+static gboolean rf_trace_emit(struct rftrace *trace, int opcode, int off, int delta) {
+  struct rftrace_op *op;
+
+  /* fuse consecutive deltas to the same word */
+  if (opcode==RFTRACE_ADD && trace->num_ops>0) {
+    op = &trace->ops[trace->num_ops-1];
+    if (op->opcode==RFTRACE_ADD && op->off==off) {
+      op->delta += delta;
+      return TRUE;
+    }
+  }
+
+  if (trace->num_ops>=RFTRACE_MAX_OPS) {
+    return FALSE;
+  }
+
+  op = &trace->ops[trace->num_ops++];
+  op->opcode = opcode;
+  op->off = off;
+  op->delta = delta;
+
+  return TRUE;
+}
+
+
+/* Translate loop body into operations. Marks the trace untraceable, if the
+ * body contains instructions that can't be traced (nested loops, forks, ...)
+ */
+static void rf_trace_compile(rfvm_t *vm, struct rftrace *trace) {
+  rfp_t p;
+  rfword_t word = 0;
+  int off = 0;
+  unsigned int i;
+  gboolean ok = TRUE;
+  struct rftrace_op *op;
+
+  trace->state = RFTRACE_UNTRACEABLE;
+  trace->num_ops = 0;
+
+  /* '[' may have been overwritten since its back-edge was taken */
+  if (!rf_trace_peek(vm, trace->start, &word) || word!='[') {
+    return;
+  }
+
+  for (p=trace->start+1; ok && p<=trace->start+RFTRACE_MAX_LENGTH; p++) {
+    if (!rf_trace_peek(vm, p, &word)) {
+      return;
+    }
+
+    switch (word) {
+      case ']':
+        break;
+      case '>':
+        off++;
+        break;
+      case '<':
+        off--;
+        break;
+      case '+':
+        ok = rf_trace_emit(trace, RFTRACE_ADD, off, 1);
+        break;
+      case '-':
+        ok = rf_trace_emit(trace, RFTRACE_ADD, off, -1);
+        break;
+      case '^':
+        ok = rf_trace_emit(trace, RFTRACE_PUSH, off, 0);
+        trace->pushes++;
+        break;
+      case 'V':
+        ok = rf_trace_emit(trace, RFTRACE_POP, off, 0);
+        trace->pops++;
+        break;
+      case '[':
+      case ',':
+      case '*':
+      case 'Y':
+      case '$':
+        return;
+      default:
+        /* no-op, costs an instruction */
+        break;
+    }
+
+    if (word==']') {
+      break;
+    }
+  }
+
+  if (!ok || word!=']') {
+    return;
+  }
+
+  trace->end = p;
+  trace->cost = trace->end-trace->start+1;
+  trace->shift = off;
+
+  /* range of written DP offsets & counter delta */
+  for (i=0; i<trace->num_ops; i++) {
+    op = &trace->ops[i];
+    if (op->opcode==RFTRACE_ADD || op->opcode==RFTRACE_POP) {
+      if (!trace->writes_dp) {
+        trace->min_off = op->off;
+        trace->max_off = op->off;
+        trace->writes_dp = TRUE;
+      }
+      trace->min_off = MIN(trace->min_off, op->off);
+      trace->max_off = MAX(trace->max_off, op->off);
+    }
+    if (op->opcode==RFTRACE_ADD && op->off==0) {
+      trace->step += op->delta;
+    }
+  }
+
+  /* loops that only add constants, counting down or up by one */
+  trace->idiom = RFTRACE_GENERIC;
+  trace->step &= 0xFF;
+  if (trace->shift==0 && trace->pushes==0 && trace->pops==0 && (trace->step==0x01 || trace->step==0xFF)) {
+    trace->idiom = trace->num_ops==1 ? RFTRACE_CLEAR : RFTRACE_MULTIPLY;
+  }
+
+  trace->state = RFTRACE_COMPILED;
+  rf_trace_link(vm, trace, TRUE);
+  vm->trace.num_compiled++;
+}
+
+
+/* Returns TRUE if the next iteration may write into the loop itself */
+static inline gboolean rf_trace_writes_loop(struct rftrace *trace, rfth_t *thread) {
+  if (trace->writes_dp && thread->dp+trace->max_off>=trace->start && thread->dp+trace->min_off<=trace->end) {
+    return TRUE;
+  }
+  if (trace->pushes>0 && thread->sp+(rfp_t)trace->pops>=trace->start && thread->sp-(rfp_t)trace->pushes<=trace->end) {
+    return TRUE;
+  }
+  return FALSE;
+}
+
+
+/* Run one iteration of loop. Returns word at DP (checked by ']') */
+static inline rfword_t rf_trace_iterate(rfvm_t *vm, struct rftrace *trace, rfth_t *thread) {
+  unsigned int i;
+  struct rftrace_op *op;
+  rfword_t data;
+  const unsigned int page_shift = vm->page_shift;
+
+  for (i=0; i<trace->num_ops; i++) {
+    op = &trace->ops[i];
+    switch (op->opcode) {
+      case RFTRACE_ADD:
+        data = rf_memory_read_fast(vm, thread->dp+op->off, &thread->tlb, page_shift);
+        rf_memory_write_fast(vm, thread->dp+op->off, data+op->delta, &thread->tlb, page_shift);
+        break;
+
+      case RFTRACE_PUSH:
+        thread->sp--;
+        vm->stack.shared += rf_memory_move_fast(vm, thread->dp+op->off, thread->sp, &thread->tlb, page_shift);
+        break;
+
+      case RFTRACE_POP:
+        vm->stack.shared += rf_memory_move_fast(vm, thread->sp, thread->dp+op->off, &thread->tlb, page_shift);
+        thread->sp++;
+        break;
+    }
+  }
+
+  thread->dp += trace->shift;
+
+  return rf_memory_read_fast(vm, thread->dp, &thread->tlb, page_shift);
+}
+
+
+/* Run k iterations of a clear or multiply loop at once
+ * NOTE: Words are accessed in the same order as in the first iteration, so
+ *       that pages are created in the same order as by the interpreter.
+ */
+static inline void rf_trace_iterate_linear(rfvm_t *vm, struct rftrace *trace, rfth_t *thread, unsigned int k) {
+  unsigned int i;
+  struct rftrace_op *op;
+  rfword_t data;
+  const unsigned int page_shift = vm->page_shift;
+
+  for (i=0; i<trace->num_ops; i++) {
+    op = &trace->ops[i];
+    data = rf_memory_read_fast(vm, thread->dp+op->off, &thread->tlb, page_shift);
+    rf_memory_write_fast(vm, thread->dp+op->off, data+op->delta*(int)k, &thread->tlb, page_shift);
+  }
+}
+
+
+/* Run loop at IP from trace cache, after its back-edge was taken. Runs at
+ * most n instructions and stops before the next scheduled mutation.
+ * Returns number of executed instructions (0 if the interpreter must run the
+ * next instruction).
+ */
+unsigned int rf_trace_run(rfvm_t *vm, rfth_t *thread, unsigned int n) {
+  struct rftrace *trace;
+  guint64 limit;
+  unsigned int k, counter, needed, executed = 0;
+  gboolean exited = FALSE;
+
+  /* instructions until the next mutation or the thread's death */
+  limit = MIN((guint64)n, MIN(vm->mutations.next_instr, MIN(vm->mutations.next_mem, vm->mutations.next_kill))-1);
+  if (vm->conf.max_cycles>0) {
+    limit = MIN(limit, thread->clock<vm->conf.max_cycles ? vm->conf.max_cycles-thread->clock-1 : 0);
+  }
+  if (limit<2) {
+    return 0;
+  }
+
+  /* look up loop & count back-edge */
+  trace = g_hash_table_lookup(vm->trace.cache, GINT_TO_POINTER(thread->ip));
+  if (trace==NULL) {
+    if (g_hash_table_size(vm->trace.cache)>=RFTRACE_MAX_ENTRIES) {
+      rf_trace_flush(vm);
+    }
+    trace = g_new0(struct rftrace, 1);
+    trace->start = thread->ip;
+    trace->state = RFTRACE_COLD;
+    g_hash_table_insert(vm->trace.cache, GINT_TO_POINTER(trace->start), trace);
+  }
+  if (trace->state==RFTRACE_COLD && ++trace->hits>=RFTRACE_HOT) {
+    rf_trace_compile(vm, trace);
+  }
+  if (trace->state!=RFTRACE_COMPILED || trace->cost>limit) {
+    return 0;
+  }
+
+  /* '[' itself: other threads may have cleared the word at DP, if the
+   * back-edge was taken in an earlier quantum
+   */
+  counter = (unsigned char)rf_memory_read_fast(vm, thread->dp, &thread->tlb, vm->page_shift);
+  if (counter==0) {
+    return 0;
+  }
+
+  switch (trace->idiom) {
+    case RFTRACE_CLEAR:
+    case RFTRACE_MULTIPLY:
+      if (rf_trace_writes_loop(trace, thread)) {
+        return 0;
+      }
+
+      /* number of iterations until counter is 0 */
+      needed = trace->step==0x01 ? 0x100-counter : counter;
+      k = MIN(needed, limit/trace->cost);
+
+      rf_trace_iterate_linear(vm, trace, thread, k);
+      executed = k*trace->cost;
+      exited = k==needed;
+      break;
+
+    default:
+      /* traces that keep running are compiled to native code (which doesn't
+       * record writers)
+       */
+      if (vm->conf.engine==RFENGINE_NATIVE && !vm->conf.provenance) {
+        if (trace->native==NULL && trace->runs++==RFNATIVE_HOT) {
+          trace->native = rf_native_compile(trace);
+          vm->trace.num_native += trace->native!=NULL;
+        }
+        if (trace->native!=NULL) {
+          executed = rf_native_run(vm, trace, thread, limit, &exited);
+          vm->trace.native_instructions += executed;
+        }
+      }
+
+      if (executed==0) {
+        while (executed+trace->cost<=limit && !rf_trace_writes_loop(trace, thread)) {
+          executed += trace->cost;
+          if (rf_trace_iterate(vm, trace, thread)==0) {
+            exited = TRUE;
+            break;
+          }
+        }
+      }
+      if (executed==0) {
+        return 0;
+      }
+      break;
+  }
+
+  if (exited) {
+    /* ']' falls through, '[' is popped */
+    thread->pstack = g_slist_delete_link(thread->pstack, thread->pstack);
+    thread->ip = trace->end+1;
+    thread->backedge = FALSE;
+  }
+  else {
+    /* continue with '[', so the trace is tried again in the next quantum */
+    thread->ip = trace->start;
+    thread->backedge = TRUE;
+  }
+
+  /* pushes & pops of the iterations (see stack.h) */
+  if (trace->pushes>0 || trace->pops>0) {
+    vm->stack.pushes += (guint64)(executed/trace->cost)*trace->pushes;
+    vm->stack.pops += (guint64)(executed/trace->cost)*trace->pops;
+    rf_stack_push_bounds(vm, thread);
+  }
+
+  thread->clock += executed;
+  vm->mutations.next_instr -= executed;
+  vm->mutations.next_mem -= executed;
+  vm->mutations.next_kill -= executed;
+  vm->trace.instructions += executed;
+
+  return executed;
+}
@@ -32,29 +32,45 @@
 
 #include "tui.h"
 #include "replifuck.h"
+#include "page.h"
+#include "inspect.h"
+#include "lineage.h"
+#include "monitor.h"
+#include "writer.h"
 
 
 #define TUI_CHAR_NOT_PRITABLE '.'
 #define TUI_CHAR_PRINT(c) (isprint(c)?(c):TUI_CHAR_NOT_PRITABLE)
 
 
+static const char *tui_metric_names[] = {
+  "instructions",
+  "writes",
+  "threads",
+  "signatures"
+};
+
+
 int tui_init(tui_t *tui, rfvm_t *vm) {
   rfth_t *thread;
 
   memset(tui, 0, sizeof(tui_t));
 
   tui->vm = vm;
-  tui->cycles_per_frame = 1;
+  tui->zoom = 1;
   thread = rf_get_thread(vm, tui->current_thread);
   if (thread!=NULL) {
     tui_memview_goto(tui, thread->ip);
   }
+  g_mutex_init(&tui->vm_lock);
+  g_mutex_init(&tui->snapshot_lock);
+  tui->writer = rf_writer_new();
 
   tui->win_main = initscr();
   start_color();
   curs_set(0);
   noecho();
-  nodelay(tui->win_main, TRUE);
+  wtimeout(tui->win_main, 1000/TUI_FPS);
   cbreak();
   keypad(tui->win_main, TRUE);
   init_pair(1, COLOR_YELLOW, COLOR_BLUE); 
@@ -73,17 +89,32 @@ int tui_init(tui_t *tui, rfvm_t *vm) {
 
 void tui_finalize(tui_t *tui) {
   endwin();
+  g_mutex_clear(&tui->vm_lock);
+  g_mutex_clear(&tui->snapshot_lock);
 }
 
 
-void tui_win_main(tui_t *tui) {
-  rfvm_t *vm = tui->vm;
+/* Draw overview of pages into memory window */
+static void tui_win_overview(tui_t *tui, const struct tui_snapshot *snapshot) {
+  const struct tui_request *request = &snapshot->request;
+  guint8 level;
+  int i;
+
+  mvwaddstr(tui->win_mem, 0, 1, "[Overview]");
+  mvwprintw(tui->win_mem, 1, 2, "Pages: %d - %d, %u/cell, %s", snapshot->overview_first, snapshot->overview_first+TUI_OVERVIEW_CELLS*(int)request->zoom-1, request->zoom, tui_metric_names[request->metric]);
+
+  for (i=0; i<TUI_OVERVIEW_CELLS; i++) {
+    level = snapshot->overview[i];
+    mvwaddch(tui->win_mem, 2+i/TUI_MEM_VIEW, 1+i%TUI_MEM_VIEW, level==TUI_NO_PAGES ? ' ' : TUI_SHADES[level]);
+  }
+}
+
+
+/* Draw snapshot */
+void tui_win_main(tui_t *tui, const struct tui_snapshot *snapshot) {
+  const struct tui_request *request = &snapshot->request;
   const char *title = "[replfuck]";
-  unsigned int num_threads;
   int i;
-  double memory_usage;
-  rfth_t *thread = NULL;
-  rfword_t b;
 
   clear();
   wbkgd(tui->win_main, COLOR_PAIR(1));
@@ -96,96 +127,123 @@ void tui_win_main(tui_t *tui) {
   box(tui->win_mem, 0, 0);
 
   mvwaddstr(tui->win_main, 0, (80-strlen(title))/2, title);
-  mvwprintw(tui->win_main, 22, 1, "%d cycles/frame", tui->cycles_per_frame);
-  mvwprintw(tui->win_main, 22, 73, "[H]elp", tui->cycles_per_frame);
-
-  num_threads = rf_get_num_threads(vm);
-  memory_usage = ((double)rf_get_memory_usage(vm)/1024.0);
+  if (tui->rate>0) {
+    mvwprintw(tui->win_main, 22, 1, "%.0f cycles/s (target %u)", snapshot->rate, tui->rate);
+  }
+  else {
+    mvwprintw(tui->win_main, 22, 1, "%.0f cycles/s (full speed)", snapshot->rate);
+  }
+  if (snapshot->store.num_pending>0) {
+    mvwprintw(tui->win_main, 22, 36, "Storing %u state(s)", snapshot->store.num_pending);
+  }
+  else if (snapshot->store.num_stored+snapshot->store.num_failed>0) {
+    if (snapshot->store.stored) {
+      mvwprintw(tui->win_main, 22, 36, "Stored clock %u in %.2f s", snapshot->store.clock, snapshot->store.seconds);
+    }
+    else {
+      mvwprintw(tui->win_main, 22, 36, "Can't store clock %u", snapshot->store.clock);
+    }
+  }
+  mvwprintw(tui->win_main, 22, 73, "[H]elp");
 
   mvwaddstr(tui->win_vm, 0, 1, "[Virtual Machine]");
-  mvwprintw(tui->win_vm, 1, 2, "Clock:       %u", vm->clock);
-  mvwprintw(tui->win_vm, 2, 2, "Threads:     %u", num_threads);
-  mvwprintw(tui->win_vm, 3, 2, "Memory:      %.2f kB", memory_usage);
-//  mvwprintw(tui->win_vm, 4, 2, "Error rate:  %.4f%%, %.4f%%, %.4f%%", 100.0*vm->mutations.rate_instr, 100.0*vm->mutations.rate_mem, 100.0*vm->mutations.rate_kill);
-  mvwprintw(tui->win_vm, 4, 2, "Errors:      %u, %u, %u", vm->mutations.num_instr, vm->mutations.num_mem, vm->mutations.num_kill);
+  mvwprintw(tui->win_vm, 1, 2, "Clock:       %u", snapshot->clock);
+  mvwprintw(tui->win_vm, 2, 2, "Threads:     %u (%u reaped)", snapshot->num_threads, snapshot->num_reaped);
+  mvwprintw(tui->win_vm, 3, 2, "Memory:      %.2f kB", (double)snapshot->memory_usage/1024.0);
+  mvwprintw(tui->win_vm, 4, 2, "Errors:      %u, %u, %u", snapshot->num_mutations[0], snapshot->num_mutations[1], snapshot->num_mutations[2]);
+  mvwprintw(tui->win_vm, 6, 2, "Instr.:      %lu", (unsigned long)snapshot->instructions);
+  mvwprintw(tui->win_vm, 5, 2, "TLB:         %.2f%% hits", snapshot->tlb_hits+snapshot->tlb_misses>0?100.0*snapshot->tlb_hits/(snapshot->tlb_hits+snapshot->tlb_misses):0.0);
+  mvwprintw(tui->win_vm, 7, 2, "Traced:      %.2f%% (%u loops)", snapshot->instructions>0?100.0*snapshot->traced_instructions/snapshot->instructions:0.0, snapshot->num_traces);
+  if (tui->monitor!=NULL) {
+    if (snapshot->monitor_state==RFMONITOR_RUNNING) {
+      mvwaddstr(tui->win_vm, 8, 2, "Run:         running");
+    }
+    else if (snapshot->checkpoint_stored) {
+      mvwprintw(tui->win_vm, 8, 2, "Run:         %s, stored", rf_monitor_state_name(snapshot->monitor_state));
+    }
+    else {
+      mvwprintw(tui->win_vm, 8, 2, "Run:         %s at %u", rf_monitor_state_name(snapshot->monitor_state), snapshot->monitor_clock);
+    }
+  }
 
-  if (num_threads==0) {
+  if (snapshot->num_threads==0) {
     mvwaddstr(tui->win_th, 0, 1, "[Thread (none)]");
   }
   else {
-    if (tui->current_thread>=num_threads) {
-      tui->current_thread = num_threads-1;
+    if (tui->current_thread>=snapshot->num_threads) {
+      tui->current_thread = snapshot->num_threads-1;
     }
     else if (tui->current_thread<0) {
       tui->current_thread = 0;
     }
 
-    thread = rf_get_thread(vm, tui->current_thread);
-    mvwprintw(tui->win_th, 0, 1, "[Thread %d/%d]", tui->current_thread+1, num_threads);
-    mvwprintw(tui->win_th, 1, 2, "Clock:  %u", thread->clock);
-    b = rf_memory_read(vm, thread->ip, NULL);
-    mvwprintw(tui->win_th, 2, 2, "IP:     %d - %02X '%c'", thread->ip, b&0xFF, TUI_CHAR_PRINT(b));
-    b = rf_memory_read(vm, thread->dp, NULL);
-    mvwprintw(tui->win_th, 3, 2, "DP:     %d - %02X '%c'", thread->dp, b&0xFF, TUI_CHAR_PRINT(b));
-    b = rf_memory_read(vm, thread->sp, NULL);
-    mvwprintw(tui->win_th, 4, 2, "SP:     %d - %02X '%c'", thread->sp, b&0xFF, TUI_CHAR_PRINT(b));
-    mvwprintw(tui->win_th, 5, 2, "IP PC:  %d -> %p", thread->page_cache_ip.pid, thread->page_cache_ip.page);
-    mvwprintw(tui->win_th, 6, 2, "DP PC:  %d -> %p", thread->page_cache_dp.pid, thread->page_cache_dp.page);
-    mvwprintw(tui->win_th, 7, 2, "SP PC:  %d -> %p", thread->page_cache_sp.pid, thread->page_cache_sp.page);
+    mvwprintw(tui->win_th, 0, 1, "[Thread %d/%d]", request->current_thread+1, snapshot->num_threads);
+    mvwprintw(tui->win_th, 1, 2, "Clock:  %u", snapshot->thread.clock);
+    mvwprintw(tui->win_th, 2, 2, "IP:     %d - %02X '%c'", snapshot->thread.ip, snapshot->thread.at_ip&0xFF, TUI_CHAR_PRINT(snapshot->thread.at_ip));
+    mvwprintw(tui->win_th, 3, 2, "DP:     %d - %02X '%c'", snapshot->thread.dp, snapshot->thread.at_dp&0xFF, TUI_CHAR_PRINT(snapshot->thread.at_dp));
+    mvwprintw(tui->win_th, 4, 2, "SP:     %d - %02X '%c'", snapshot->thread.sp, snapshot->thread.at_sp&0xFF, TUI_CHAR_PRINT(snapshot->thread.at_sp));
+    mvwprintw(tui->win_th, 5, 2, "TLB:    %lu hits, %lu misses", snapshot->thread.tlb_hits, snapshot->thread.tlb_misses);
+    mvwprintw(tui->win_th, 6, 2, "Stack:  %ld deep, base %ld", (long)(snapshot->thread.sb-snapshot->thread.sp), (long)snapshot->thread.sb);
+    mvwprintw(tui->win_th, 7, 2, "Stacks: max. %lu, %lu underflows", (unsigned long)snapshot->stack_max_depth, (unsigned long)snapshot->stack_underflows);
+  }
+
+  if (request->overview) {
+    tui_win_overview(tui, snapshot);
+    refresh();
+    return;
   }
 
-  b = rf_memory_read(vm, tui->mem_p, NULL);
   mvwaddstr(tui->win_mem, 0, 1, "[Memory]");
-  mvwprintw(tui->win_mem, 1, 2, "View: %d - %d", tui->mem_view, tui->mem_view+76);
-  mvwprintw(tui->win_mem, 2, 2, "Pos:  %d - %02X '%c'", tui->mem_p, b&0xFF, TUI_CHAR_PRINT(b));
-  mvwhline(tui->win_mem, 4, 1, ACS_HLINE, 76);
-  mvwhline(tui->win_mem, 6, 1, ACS_HLINE, 76);
-  mvwhline(tui->win_mem, 7, 1, ACS_HLINE, 76);
-  mvwhline(tui->win_mem, 8, 1, ACS_HLINE, 76);
-
-  i = tui->mem_p-tui->mem_view;
+  mvwprintw(tui->win_mem, 1, 2, "View: %d - %d", request->mem_view, request->mem_view+TUI_MEM_VIEW);
+  mvwprintw(tui->win_mem, 2, 2, "Pos:  %d - %02X '%c'", request->mem_p, snapshot->at_mem_p&0xFF, TUI_CHAR_PRINT(snapshot->at_mem_p));
+  mvwhline(tui->win_mem, 4, 1, ACS_HLINE, TUI_MEM_VIEW);
+  mvwhline(tui->win_mem, 6, 1, ACS_HLINE, TUI_MEM_VIEW);
+  mvwhline(tui->win_mem, 7, 1, ACS_HLINE, TUI_MEM_VIEW);
+  mvwhline(tui->win_mem, 8, 1, ACS_HLINE, TUI_MEM_VIEW);
+
+  i = request->mem_p-request->mem_view;
   if (i<0) {
     mvwaddch(tui->win_mem, 4, 1, '<');
   }
-  else if (i>=76) {
-    mvwaddch(tui->win_mem, 4, 76, '>');
+  else if (i>=TUI_MEM_VIEW) {
+    mvwaddch(tui->win_mem, 4, TUI_MEM_VIEW, '>');
   }
   else {
     mvwaddch(tui->win_mem, 4, i+1, 'V');
   }
   mvwaddstr(tui->win_mem, 4, i>35?1:77-8, "[SELECT]");
 
-  if (thread!=NULL) {
-    i = thread->ip-tui->mem_view;
+  if (snapshot->num_threads>0) {
+    i = snapshot->thread.ip-request->mem_view;
     if (i<0) {
     mvwaddch(tui->win_mem, 6, 1, '<');
     }
-    else if (i>=76) {
-      mvwaddch(tui->win_mem, 6, 76, '>');
+    else if (i>=TUI_MEM_VIEW) {
+      mvwaddch(tui->win_mem, 6, TUI_MEM_VIEW, '>');
     }
     else {
       mvwaddch(tui->win_mem, 6, i+1, ACS_UARROW);
     }
     mvwaddstr(tui->win_mem, 6, i>35?1:77-4, "[IP]");
 
-    i = thread->dp-tui->mem_view;
+    i = snapshot->thread.dp-request->mem_view;
     if (i<0) {
       mvwaddch(tui->win_mem, 7, 1, '<');
     }
-    else if (i>=76) {
-      mvwaddch(tui->win_mem, 7, 76, '>');
+    else if (i>=TUI_MEM_VIEW) {
+      mvwaddch(tui->win_mem, 7, TUI_MEM_VIEW, '>');
     }
     else {
       mvwaddch(tui->win_mem, 7, i+1, ACS_UARROW);
     }
     mvwaddstr(tui->win_mem, 7, i>35?1:77-4, "[DP]");
 
-    i = thread->sp-tui->mem_view;
+    i = snapshot->thread.sp-request->mem_view;
     if (i<0) {
       mvwaddch(tui->win_mem, 8, 1, '<');
     }
-    else if (i>=76) {
-      mvwaddch(tui->win_mem, 8, 76, '>');
+    else if (i>=TUI_MEM_VIEW) {
+      mvwaddch(tui->win_mem, 8, TUI_MEM_VIEW, '>');
     }
     else {
       mvwaddch(tui->win_mem, 8, i+1, ACS_UARROW);
@@ -194,17 +252,287 @@ void tui_win_main(tui_t *tui) {
 
   }
 
-  for (i=0; i<76; i++) {
-    b = rf_memory_read(vm, tui->mem_view+i, NULL);
-    if (isprint(b)) {
-      mvwaddch(tui->win_mem, 5, i+1, b);
+  for (i=0; i<TUI_MEM_VIEW; i++) {
+    mvwaddch(tui->win_mem, 5, i+1, TUI_CHAR_PRINT(snapshot->view[i]));
+  }
+
+  refresh();
+}
+
+
+/* Overview being built */
+struct tui_overview_args {
+  const struct tui_request *request;
+  int first;
+  guint64 values[TUI_OVERVIEW_CELLS];
+  gboolean used[TUI_OVERVIEW_CELLS];
+};
+
+/* Iterator: adds page summary to its cell. Pages are visited in order */
+static gboolean tui_overview_iter(void *key, void *value, void *userdata) {
+  struct tui_overview_args *args = (struct tui_overview_args*)userdata;
+  rfpage_t *page = (rfpage_t*)value;
+  int pid = GPOINTER_TO_INT(key);
+  unsigned int cell;
+
+  if (pid<args->first) {
+    return FALSE;
+  }
+  cell = (unsigned int)(pid-args->first)/args->request->zoom;
+  if (cell>=TUI_OVERVIEW_CELLS) {
+    return TRUE;
+  }
+
+  args->used[cell] = TRUE;
+  switch (args->request->metric) {
+    case TUI_METRIC_OPCODES:
+      args->values[cell] += page->summary.num_opcodes;
+      break;
+    case TUI_METRIC_WRITES:
+      args->values[cell] += page->summary.num_writes;
+      break;
+    case TUI_METRIC_SIGNATURES:
+      args->values[cell] += page->summary.num_signatures;
+      break;
+  }
+
+  return FALSE;
+}
+
+/* Fill overview of snapshot from page summaries (doesn't read any words) */
+static void tui_overview(tui_t *tui, struct tui_snapshot *snapshot) {
+  rfvm_t *vm = tui->vm;
+  struct tui_overview_args *args;
+  rfth_t *thread;
+  guint64 max = 0, total;
+  unsigned int off, cell, i;
+  int pid;
+
+  args = g_new0(struct tui_overview_args, 1);
+  args->request = &snapshot->request;
+  rf_memory_get_pid_and_offset(snapshot->request.mem_view, vm->page_shift, &pid, &off);
+  args->first = pid-(int)(((unsigned int)pid)%snapshot->request.zoom);
+
+  g_tree_foreach(vm->memory, tui_overview_iter, args);
+
+  /* writes since the last snapshot (pages aren't changed, they may be shared
+   * with clones)
+   */
+  if (snapshot->request.metric==TUI_METRIC_WRITES) {
+    for (i=0; i<TUI_OVERVIEW_CELLS; i++) {
+      total = args->values[i];
+      if (tui->overview_writes_zoom!=snapshot->request.zoom || tui->overview_writes_first!=args->first) {
+        args->values[i] = 0;
+      }
+      else {
+        args->values[i] = total>=tui->overview_writes[i] ? total-tui->overview_writes[i] : 0;
+      }
+      tui->overview_writes[i] = total;
+    }
+    tui->overview_writes_first = args->first;
+    tui->overview_writes_zoom = snapshot->request.zoom;
+  }
+  else {
+    tui->overview_writes_zoom = 0;
+  }
+
+  if (snapshot->request.metric==TUI_METRIC_THREADS) {
+    for (i=0; i<vm->threads->len; i++) {
+      thread = g_ptr_array_index(vm->threads, i);
+      rf_memory_get_pid_and_offset(thread->ip, vm->page_shift, &pid, &off);
+      cell = (unsigned int)(pid-args->first)/snapshot->request.zoom;
+      if (pid>=args->first && cell<TUI_OVERVIEW_CELLS) {
+        args->values[cell]++;
+      }
+    }
+  }
+
+  for (i=0; i<TUI_OVERVIEW_CELLS; i++) {
+    max = MAX(max, args->values[i]);
+  }
+  for (i=0; i<TUI_OVERVIEW_CELLS; i++) {
+    if (!args->used[i]) {
+      snapshot->overview[i] = TUI_NO_PAGES;
     }
     else {
-      mvwaddch(tui->win_mem, 5, i+1, '.');
+      snapshot->overview[i] = max>0 ? (guint8)(args->values[i]*(TUI_NUM_SHADES-1)/max) : 0;
     }
   }
+  snapshot->overview_first = args->first;
 
-  refresh();
+  g_free(args);
+}
+
+
+/* Take snapshot of VM for request (called by simulation thread, holding the
+ * VM lock) and publish it
+ */
+static void tui_snapshot(tui_t *tui, const struct tui_request *request, double rate) {
+  rfvm_t *vm = tui->vm;
+  struct tui_snapshot *snapshot;
+  rfth_t *thread;
+
+  /* only the front buffer is read by the TUI */
+  snapshot = &tui->snapshots[1-tui->front];
+  snapshot->request = *request;
+
+  snapshot->clock = vm->clock;
+  snapshot->num_threads = rf_get_num_threads(vm);
+  snapshot->num_reaped = vm->reaper.num_reaped;
+  snapshot->memory_usage = rf_get_memory_usage(vm);
+  snapshot->num_mutations[0] = vm->mutations.num_instr;
+  snapshot->num_mutations[1] = vm->mutations.num_mem;
+  snapshot->num_mutations[2] = vm->mutations.num_kill;
+  snapshot->instructions = vm->instructions;
+  snapshot->traced_instructions = vm->trace.instructions;
+  snapshot->num_traces = vm->trace.num_compiled-vm->trace.num_invalidated;
+  rf_get_tlb_stats(vm, &snapshot->tlb_hits, &snapshot->tlb_misses);
+  snapshot->stack_max_depth = vm->stack.max_depth;
+  snapshot->stack_underflows = vm->stack.underflows;
+  snapshot->rate = rate;
+  if (tui->monitor!=NULL) {
+    snapshot->monitor_state = tui->monitor->state;
+    snapshot->monitor_clock = tui->monitor->clock;
+    snapshot->checkpoint_stored = tui->checkpoint_stored;
+  }
+  snapshot->store = tui->store;
+  snapshot->store.num_pending = tui->writer->num_pending;
+
+  if (snapshot->num_threads>0) {
+    snapshot->request.current_thread = CLAMP(request->current_thread, 0, (int)snapshot->num_threads-1);
+    thread = rf_get_thread(vm, snapshot->request.current_thread);
+    snapshot->thread.clock = thread->clock;
+    snapshot->thread.ip = thread->ip;
+    snapshot->thread.dp = thread->dp;
+    snapshot->thread.sp = thread->sp;
+    snapshot->thread.sb = thread->sb;
+    snapshot->thread.at_ip = rf_memory_read(vm, thread->ip, &tui->tlb);
+    snapshot->thread.at_dp = rf_memory_read(vm, thread->dp, &tui->tlb);
+    snapshot->thread.at_sp = rf_memory_read(vm, thread->sp, &tui->tlb);
+    snapshot->thread.tlb_hits = thread->tlb.hits;
+    snapshot->thread.tlb_misses = thread->tlb.misses;
+  }
+
+  rf_memory_read_range(vm, request->mem_view, snapshot->view, TUI_MEM_VIEW, &tui->tlb);
+  snapshot->at_mem_p = rf_memory_read(vm, request->mem_p, &tui->tlb);
+
+  if (request->overview) {
+    tui_overview(tui, snapshot);
+  }
+  else {
+    tui->overview_writes_zoom = 0;
+  }
+
+  g_mutex_lock(&tui->snapshot_lock);
+  tui->front = 1-tui->front;
+  g_mutex_unlock(&tui->snapshot_lock);
+}
+
+
+/* Take results of states written in the background (called by simulation
+ * thread, holding the VM lock)
+ */
+static void tui_poll_writer(tui_t *tui) {
+  struct rfwriter_job *job;
+
+  while ((job = rf_writer_poll(tui->writer))!=NULL) {
+    if (job->stored) {
+      tui->store.num_stored++;
+    }
+    else {
+      tui->store.num_failed++;
+    }
+    tui->store.stored = job->stored;
+    tui->store.clock = job->clock;
+    tui->store.seconds = job->seconds;
+
+    if (tui->checkpoint!=NULL && strcmp(job->filename, tui->checkpoint)==0) {
+      tui->checkpoint_stored = job->stored;
+    }
+    rf_writer_job_free(job);
+  }
+}
+
+
+/* Simulation thread: runs cycles at the requested rate and publishes a
+ * snapshot after each batch
+ */
+static gpointer tui_simulate(gpointer data) {
+  tui_t *tui = (tui_t*)data;
+  struct tui_request request;
+  gboolean paced = FALSE, halted = FALSE;
+  unsigned int pace_rate = 0, n;
+  guint64 pace_cycles = 0;
+  gint64 now, end, pace_start = 0, rate_start;
+  unsigned int rate_clock;
+  double rate = 0.0;
+
+  rate_start = g_get_monotonic_time();
+  rate_clock = tui->vm->clock;
+
+  while (g_atomic_int_get(&tui->running)) {
+    g_mutex_lock(&tui->snapshot_lock);
+    request = tui->request;
+    g_mutex_unlock(&tui->snapshot_lock);
+
+    g_mutex_lock(&tui->vm_lock);
+
+    /* run cycles until the batch time is over or the target rate is reached */
+    now = g_get_monotonic_time();
+    if (!paced || request.rate!=pace_rate || !request.autostep) {
+      paced = request.autostep;
+      pace_rate = request.rate;
+      pace_start = now;
+      pace_cycles = 0;
+    }
+    /* after a state was detected, wait for the TUI to stop autostep */
+    if (!request.autostep) {
+      halted = FALSE;
+    }
+    n = 0;
+    if (request.autostep && !halted) {
+      end = now+TUI_BATCH_TIME;
+      do {
+        if (pace_rate>0 && pace_cycles>=(guint64)pace_rate*(now-pace_start)/G_USEC_PER_SEC) {
+          break;
+        }
+        rf_vm_cycle(tui->vm);
+        pace_cycles++;
+        n++;
+        now = g_get_monotonic_time();
+        if (tui->monitor!=NULL && rf_monitor_update(tui->monitor, tui->vm)) {
+          /* stored in the background, unless too many states are written */
+          if (tui->checkpoint!=NULL && !rf_writer_store(tui->writer, tui->vm, tui->checkpoint)) {
+            tui->checkpoint_stored = rf_vm_store(tui->vm, tui->checkpoint);
+          }
+          halted = TRUE;
+          break;
+        }
+      } while (now<end);
+    }
+
+    /* measure rate over about a second */
+    if (now-rate_start>=G_USEC_PER_SEC) {
+      rate = (double)(tui->vm->clock-rate_clock)*G_USEC_PER_SEC/(now-rate_start);
+      rate_start = now;
+      rate_clock = tui->vm->clock;
+    }
+
+    if (tui->inspect!=NULL) {
+      rf_inspect_poll(tui->inspect);
+    }
+    tui_poll_writer(tui);
+    tui_snapshot(tui, &request, rate);
+
+    g_mutex_unlock(&tui->vm_lock);
+
+    /* nothing to do: wait a bit, but publish at least once per frame */
+    if (n==0) {
+      g_usleep(G_USEC_PER_SEC/(2*TUI_FPS));
+    }
+  }
+
+  return NULL;
 }
 
 
@@ -223,9 +551,9 @@ gboolean tui_really_quit(tui_t *tui) {
   mvwaddstr(tui->win_main, 10, 5, "Really quit [y/N]?");
   refresh();
 
-  nodelay(tui->win_main, FALSE);
+  wtimeout(tui->win_main, -1);
   key = getch();
-  nodelay(tui->win_main, TRUE);
+  wtimeout(tui->win_main, 1000/TUI_FPS);
 
   return key=='y';
 }
@@ -236,17 +564,22 @@ void tui_show_help(tui_t *tui) {
     "F1 or H          Show help",
     "ESC or Q         Quit program",
     "UP/DOWN          Move memory view +/- 16 words",
-    "PAGEUP/PAGEDOWN  Move memory view +/- one page (4096 words)",
+    "PAGEUP/PAGEDOWN  Move memory view +/- one page (overview: one row)",
     "LEFT/RIGHT       Move memory selection +/- one word",
     "BACKSPACE        Reset memory view and selection",
     "+/-              Increment/Decrement selected word",
     ",/.              Select next/previous thread",
     "SPACE            Do one cycle",
     "ENTER            Activate/Deactive autorun",
-    "d                Dump VM state",
+    "F3/F4            Halve/Double target rate of autorun",
+    "O                Show overview of pages instead of words",
+    "z/Z              Zoom overview in/out",
+    "X                Show next metric in overview",
+    "F8               Store VM state (in the background)",
     "F5               Move memory view to selected thread's IP",
     "F6               Move memory view to selected thread's DP",
     "F7               Move memory view to selected thread's SP",
+    "F9               Export lineage",
     NULL
   };
   unsigned int i;
@@ -263,36 +596,67 @@ void tui_show_help(tui_t *tui) {
 
   refresh();
 
-  nodelay(tui->win_main, FALSE);
+  wtimeout(tui->win_main, -1);
   getch();
-  nodelay(tui->win_main, TRUE);
+  wtimeout(tui->win_main, 1000/TUI_FPS);
+}
+
+
+/* Pass current view & autostep settings to the simulation thread */
+static void tui_request(tui_t *tui) {
+  g_mutex_lock(&tui->snapshot_lock);
+  tui->request.autostep = tui->autostep;
+  tui->request.rate = tui->rate;
+  tui->request.current_thread = tui->current_thread;
+  tui->request.mem_view = tui->mem_view;
+  tui->request.mem_p = tui->mem_p;
+  tui->request.overview = tui->overview;
+  tui->request.zoom = tui->zoom;
+  tui->request.metric = tui->metric;
+  g_mutex_unlock(&tui->snapshot_lock);
 }
 
 
 void tui_main(tui_t *tui) {
   rfvm_t *vm = tui->vm;
-  rfth_t *thread;
-  int key, i;
+  struct tui_snapshot snapshot;
+  int key;
   GDateTime *datetime;
   char *filename;
   rfword_t tmp;
 
   tui->running = TRUE;
+  tui_request(tui);
+  tui->sim = g_thread_new("simulation", tui_simulate, tui);
 
   while (tui->running) {
-    if (tui->autostep) {
-      for (i=0; i<tui->cycles_per_frame; i++) {
-        rf_vm_cycle(vm);
-      }
+    g_mutex_lock(&tui->snapshot_lock);
+    snapshot = tui->snapshots[tui->front];
+    g_mutex_unlock(&tui->snapshot_lock);
+
+    /* beep once for each state that couldn't be stored */
+    if (snapshot.store.num_failed>tui->store_failures_seen) {
+      tui->store_failures_seen = snapshot.store.num_failed;
+      beep();
+    }
+
+    /* stop autostep once, when the monitor detected a state */
+    if (tui->monitor!=NULL && snapshot.monitor_state!=RFMONITOR_RUNNING && !tui->monitor_seen) {
+      tui->monitor_seen = TRUE;
+      tui->autostep = FALSE;
+      tui_request(tui);
     }
 
-    tui_win_main(tui);
+    tui_win_main(tui, &snapshot);
 
+    /* waits for a key at most one frame */
     key = getch();
     switch (key) {
       case 'q':
       case 27:
-        tui->running = !tui_really_quit(tui);
+        if (tui_really_quit(tui)) {
+          g_atomic_int_set(&tui->running, FALSE);
+        }
         break;
       case KEY_UP:
         tui->mem_view += 0x10;
@@ -301,10 +665,26 @@ void tui_main(tui_t *tui) {
         tui->mem_view -= 0x10;
         break;
       case KEY_PPAGE:
-        tui->mem_view -= RFMEM_PAGE_SIZE;
+        tui->mem_view -= tui->overview ? (rfp_t)vm->page_size*tui->zoom*TUI_MEM_VIEW : vm->page_size;
         break;
       case KEY_NPAGE:
-        tui->mem_view += RFMEM_PAGE_SIZE;
+        tui->mem_view += tui->overview ? (rfp_t)vm->page_size*tui->zoom*TUI_MEM_VIEW : vm->page_size;
+        break;
+      case 'o':
+        tui->overview = !tui->overview;
+        break;
+      case 'z':
+        if (tui->zoom>1) {
+          tui->zoom /= 2;
+        }
+        break;
+      case 'Z':
+        if (tui->zoom<TUI_MAX_ZOOM) {
+          tui->zoom *= 2;
+        }
+        break;
+      case 'x':
+        tui->metric = (tui->metric+1)%TUI_NUM_METRICS;
         break;
       case KEY_LEFT:
         tui->mem_p--;
@@ -313,12 +693,16 @@ void tui_main(tui_t *tui) {
         tui->mem_p++;
         break;
       case '+':
-        tmp = rf_memory_read(vm, tui->mem_p, &tui->page_cache);
-        rf_memory_write(vm, tui->mem_p, tmp+1, &tui->page_cache);
+        g_mutex_lock(&tui->vm_lock);
+        tmp = rf_memory_read(vm, tui->mem_p, &tui->tlb);
+        rf_memory_write(vm, tui->mem_p, tmp+1, &tui->tlb);
+        g_mutex_unlock(&tui->vm_lock);
         break;
       case '-':
-        tmp = rf_memory_read(vm, tui->mem_p, &tui->page_cache);
-        rf_memory_write(vm, tui->mem_p, tmp-1, &tui->page_cache);
+        g_mutex_lock(&tui->vm_lock);
+        tmp = rf_memory_read(vm, tui->mem_p, &tui->tlb);
+        rf_memory_write(vm, tui->mem_p, tmp-1, &tui->tlb);
+        g_mutex_unlock(&tui->vm_lock);
         break;
       case ',':
         tui->current_thread--;
@@ -333,7 +717,9 @@ void tui_main(tui_t *tui) {
         break;
       case ' ':
         if (!tui->autostep) {
+          g_mutex_lock(&tui->vm_lock);
           rf_vm_cycle(vm);
+          g_mutex_unlock(&tui->vm_lock);
         }
         break;
       case '\n':
@@ -342,47 +728,71 @@ void tui_main(tui_t *tui) {
       case KEY_F(8):
         datetime = g_date_time_new_now_local();
         filename = g_date_time_format(datetime, "vmstates/%a %b %e %H:%M:%S %Y.RFm");
-        if (!rf_vm_store(vm, filename)) {
+        g_mutex_lock(&tui->vm_lock);
+        if (!rf_writer_store(tui->writer, vm, filename)) {
+          beep();
+        }
+        g_mutex_unlock(&tui->vm_lock);
+        flash();
+        g_date_time_unref(datetime);
+        g_free(filename);
+        break;
+      case KEY_F(9):
+        datetime = g_date_time_new_now_local();
+        filename = g_date_time_format(datetime, "vmstates/%a %b %e %H:%M:%S %Y.RFl");
+        g_mutex_lock(&tui->vm_lock);
+        if (vm->lineage==NULL || !rf_lineage_export(vm->lineage, filename)) {
           beep();
         }
+        g_mutex_unlock(&tui->vm_lock);
         flash();
         g_date_time_unref(datetime);
         g_free(filename);
         break;
       case KEY_F(5):
-        thread = rf_get_thread(vm, tui->current_thread);
-        if (thread!=NULL) {
-          tui_memview_goto(tui, thread->ip);
+        if (snapshot.num_threads>0) {
+          tui_memview_goto(tui, snapshot.thread.ip);
         }
         break;
       case KEY_F(6):
-        thread = rf_get_thread(vm, tui->current_thread);
-        if (thread!=NULL) {
-          tui_memview_goto(tui, thread->dp);
+        if (snapshot.num_threads>0) {
+          tui_memview_goto(tui, snapshot.thread.dp);
         }
         break;
       case KEY_F(7):
-        thread = rf_get_thread(vm, tui->current_thread);
-        if (thread!=NULL) {
-          tui_memview_goto(tui, thread->sp);
+        if (snapshot.num_threads>0) {
+          tui_memview_goto(tui, snapshot.thread.sp);
         }
         break;
       case KEY_F(3):
-        if (tui->cycles_per_frame>1) {
-          tui->cycles_per_frame /= 2;
+        if (tui->rate==0) {
+          tui->rate = TUI_MAX_RATE;
+        }
+        else if (tui->rate>1) {
+          tui->rate /= 2;
         }
         break;
       case KEY_F(4):
-        tui->cycles_per_frame *= 2;
+        if (tui->rate>=TUI_MAX_RATE) {
+          tui->rate = 0;
+        }
+        else if (tui->rate>0) {
+          tui->rate *= 2;
+        }
         break;
       case KEY_F(1):
       case 'h':
         tui_show_help(tui);
         break;
-      case -1:
-        usleep(50000);
-        break;
     }
+
+    tui_request(tui);
   }
+
+  g_thread_join(tui->sim);
+
+  /* wait for states being written */
+  rf_writer_free(tui->writer);
+  tui->writer = NULL;
 }
 
@@ -0,0 +1,247 @@
+/* window.c - memory window backed by reserved address space
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "replifuck.h"
+#include "page.h"
+#include "provenance.h"
+#include "window.h"
+
+
+/* VMs with windows, searched by the fault handler */
+static rfvm_t *rf_window_vms[RFWINDOW_MAX_VMS];
+
+/* Fault handler is installed & the handler it replaced */
+static gsize rf_window_handler_installed = 0;
+static struct sigaction rf_window_old_action;
+
+
+/* Commit words around position of fault and fill them with their initial
+ * words. Called by the fault handler, so only async-signal-safe functions
+ * may be used.
+ */
+static void rf_window_commit(rfvm_t *vm, rfword_t *addr) {
+  rfsz_t off, i;
+  rfword_t *data;
+
+  off = (rfsz_t)(addr-vm->window.data)&~(vm->window.commit-1);
+  data = vm->window.data+off;
+  mprotect(data, sizeof(rfword_t)*vm->window.commit, PROT_READ|PROT_WRITE);
+
+  for (i=0; i<vm->window.commit; i+=vm->page_size) {
+    rf_rand_page_words(vm->conf.seed, vm->window.first+(int)((off+i)/vm->page_size), data+i, vm->page_size);
+  }
+}
+
+
+/* Fault handler: commits words of windows on first access. Other faults are
+ * passed to the replaced handler by faulting again.
+ */
+static void rf_window_fault(int sig, siginfo_t *info, void *context) {
+  rfword_t *addr = (rfword_t*)info->si_addr;
+  rfvm_t *vm;
+  unsigned int i;
+
+  for (i=0; i<RFWINDOW_MAX_VMS; i++) {
+    vm = (rfvm_t*)g_atomic_pointer_get(&rf_window_vms[i]);
+    if (vm!=NULL && addr>=vm->window.data && addr<vm->window.data+vm->window.length) {
+      rf_window_commit(vm, addr);
+      return;
+    }
+  }
+
+  sigaction(SIGSEGV, &rf_window_old_action, NULL);
+}
+
+
+/* Reserve window of (at least) num_pages pages around 0. Returns FALSE, if
+ * the address space can't be reserved (the VM works without window then).
+ */
+gboolean rf_window_init(rfvm_t *vm, unsigned int num_pages) {
+  struct sigaction action;
+  rfsz_t commit, length;
+  rfword_t *data;
+  unsigned int i, per_commit;
+
+  /* pages are committed in units of (at least) OS pages */
+  commit = MAX(vm->page_size, (rfsz_t)sysconf(_SC_PAGESIZE)/sizeof(rfword_t));
+  per_commit = commit/vm->page_size;
+  num_pages = (num_pages+per_commit-1)/per_commit*per_commit;
+  length = (rfsz_t)num_pages*vm->page_size;
+
+  data = (rfword_t*)mmap(NULL, sizeof(rfword_t)*length, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (data==(rfword_t*)MAP_FAILED) {
+    return FALSE;
+  }
+
+  if (g_once_init_enter(&rf_window_handler_installed)) {
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = rf_window_fault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &rf_window_old_action);
+    g_once_init_leave(&rf_window_handler_installed, 1);
+  }
+
+  vm->window.data = data;
+  vm->window.first = -(int)(num_pages/2);
+  vm->window.start = (rfp_t)vm->window.first*vm->page_size;
+  vm->window.length = length;
+  vm->window.pages = g_new0(rfpage_t*, num_pages);
+  vm->window.num_pages = num_pages;
+  vm->window.commit = commit;
+
+  /* the fault handler may see the window now */
+  for (i=0; i<RFWINDOW_MAX_VMS; i++) {
+    if (g_atomic_pointer_compare_and_exchange(&rf_window_vms[i], NULL, vm)) {
+      return TRUE;
+    }
+  }
+
+  /* too many windows */
+  munmap(data, sizeof(rfword_t)*length);
+  g_free(vm->window.pages);
+  memset(&vm->window, 0, sizeof(vm->window));
+
+  return FALSE;
+}
+
+
+/* Free page structure of window (words are kept) */
+static void rf_window_free_page(rfvm_t *vm, unsigned int i) {
+  rfpage_t *page = vm->window.pages[i];
+
+  if (page!=NULL) {
+    g_slist_free(page->traces);
+    rf_provenance_free(page);
+    g_free(page);
+    vm->window.pages[i] = NULL;
+  }
+}
+
+
+/* Free window
+ * NOTE: The memory tree must have been freed before.
+ */
+void rf_window_free(rfvm_t *vm) {
+  unsigned int i;
+
+  if (vm->window.data==NULL) {
+    return;
+  }
+
+  for (i=0; i<RFWINDOW_MAX_VMS; i++) {
+    g_atomic_pointer_compare_and_exchange(&rf_window_vms[i], vm, NULL);
+  }
+
+  for (i=0; i<vm->window.num_pages; i++) {
+    rf_window_free_page(vm, i);
+  }
+  g_free(vm->window.pages);
+  munmap(vm->window.data, sizeof(rfword_t)*vm->window.length);
+  memset(&vm->window, 0, sizeof(vm->window));
+}
+
+
+/* Get page of window. Pages that weren't looked up before get a page
+ * structure, which isn't in memory (like virtual pages).
+ */
+rfpage_t *rf_window_page(rfvm_t *vm, int pid) {
+  unsigned int i = (unsigned int)(pid-vm->window.first);
+  rfpage_t *page = vm->window.pages[i];
+
+  if (page==NULL) {
+    page = (rfpage_t*)g_malloc0(sizeof(rfpage_t));
+    page->data = vm->window.data+(rfsz_t)i*vm->page_size;
+    page->window = TRUE;
+    vm->window.pages[i] = page;
+  }
+
+  return page;
+}
+
+
+/* Drop pages first to last-1 (whole commit units): they're committed and
+ * filled again when accessed
+ */
+static void rf_window_discard_range(rfvm_t *vm, unsigned int first, unsigned int last) {
+  rfword_t *data = vm->window.data+(rfsz_t)first*vm->page_size;
+  size_t size = sizeof(rfword_t)*(last-first)*vm->page_size;
+  unsigned int i;
+
+  for (i=first; i<last; i++) {
+    rf_window_free_page(vm, i);
+  }
+  madvise(data, size, MADV_DONTNEED);
+  mprotect(data, size, PROT_NONE);
+}
+
+
+/* Drop page of window that isn't in memory. It gets its initial words again.
+ */
+void rf_window_discard(rfvm_t *vm, int pid) {
+  unsigned int i = (unsigned int)(pid-vm->window.first);
+
+  if (vm->page_size>=vm->window.commit) {
+    rf_window_discard_range(vm, i, i+1);
+  }
+  else {
+    /* page is committed with its neighbours, so fill it again in place */
+    rf_window_free_page(vm, i);
+    rf_rand_page_words(vm->conf.seed, pid, vm->window.data+(rfsz_t)i*vm->page_size, vm->page_size);
+  }
+}
+
+
+/* Drop all commit units without pages in memory, so that the OS can reuse
+ * memory of pages that were only read
+ */
+void rf_window_evict(rfvm_t *vm) {
+  unsigned int i, j, first = 0, per_commit;
+  gboolean unused;
+
+  per_commit = vm->window.commit/vm->page_size;
+
+  for (i=0; i<vm->window.num_pages; i+=per_commit) {
+    unused = TRUE;
+    for (j=i; unused && j<i+per_commit; j++) {
+      unused = vm->window.pages[j]==NULL || g_atomic_int_get(&vm->window.pages[j]->refs)==0;
+    }
+
+    /* discard run of unused units before this one */
+    if (!unused) {
+      if (first<i) {
+        rf_window_discard_range(vm, first, i);
+      }
+      first = i+per_commit;
+    }
+  }
+
+  if (first<vm->window.num_pages) {
+    rf_window_discard_range(vm, first, vm->window.num_pages);
+  }
+}
@@ -0,0 +1,133 @@
+/* writer.c - background writer of VM states
+ * Copyright (C) 2011 by Janosch Gräf <janosch.graef@gmx.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "replifuck.h"
+#include "writer.h"
+
+
+/* Job that stops the writer thread */
+static struct rfwriter_job rf_writer_stop;
+
+
+/* Writer thread: stores clones until it's stopped */
+static gpointer rf_writer_thread(gpointer data) {
+  struct rfwriter *writer = (struct rfwriter*)data;
+  struct rfwriter_job *job;
+  gchar *part;
+  gint64 start;
+
+  while ((job = g_async_queue_pop(writer->jobs))!=&rf_writer_stop) {
+    start = g_get_monotonic_time();
+
+    part = g_strconcat(job->filename, RFWRITER_SUFFIX, NULL);
+    job->stored = rf_vm_store(job->vm, part) && rename(part, job->filename)==0;
+    if (!job->stored) {
+      unlink(part);
+    }
+    g_free(part);
+
+    job->seconds = (g_get_monotonic_time()-start)/1e6;
+    g_async_queue_push(writer->done, job);
+  }
+
+  return NULL;
+}
+
+
+struct rfwriter *rf_writer_new(void) {
+  struct rfwriter *writer;
+
+  writer = g_new0(struct rfwriter, 1);
+  writer->jobs = g_async_queue_new();
+  writer->done = g_async_queue_new();
+  writer->thread = g_thread_new("writer", rf_writer_thread, writer);
+
+  return writer;
+}
+
+
+/* Wait for pending states to be written & free writer (results of states
+ * that weren't polled are dropped)
+ */
+void rf_writer_free(struct rfwriter *writer) {
+  struct rfwriter_job *job;
+
+  g_async_queue_push(writer->jobs, &rf_writer_stop);
+  g_thread_join(writer->thread);
+
+  while ((job = rf_writer_poll(writer))!=NULL) {
+    rf_writer_job_free(job);
+  }
+
+  g_async_queue_unref(writer->jobs);
+  g_async_queue_unref(writer->done);
+  g_free(writer);
+}
+
+
+/* Store VM to file in the background (must be called by the owner of the
+ * VM). Returns FALSE if too many states are being written
+ */
+gboolean rf_writer_store(struct rfwriter *writer, rfvm_t *vm, const char *filename) {
+  struct rfwriter_job *job;
+
+  if (writer->num_pending>=RFWRITER_MAX_PENDING) {
+    return FALSE;
+  }
+
+  job = g_new0(struct rfwriter_job, 1);
+  job->vm = rf_vm_clone(vm);
+  job->filename = g_strdup(filename);
+  job->clock = vm->clock;
+
+  writer->num_pending++;
+  g_async_queue_push(writer->jobs, job);
+
+  return TRUE;
+}
+
+
+/* Get a finished state & free its clone (must be called by the owner of the
+ * VM). Returns NULL if none is finished
+ */
+struct rfwriter_job *rf_writer_poll(struct rfwriter *writer) {
+  struct rfwriter_job *job;
+
+  job = g_async_queue_try_pop(writer->done);
+  if (job!=NULL) {
+    rf_vm_free(job->vm);
+    job->vm = NULL;
+    writer->num_pending--;
+  }
+
+  return job;
+}
+
+
+void rf_writer_job_free(struct rfwriter_job *job) {
+  g_free(job->filename);
+  g_free(job);
+}